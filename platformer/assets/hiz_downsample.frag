@@ -0,0 +1,25 @@
+#version 450 core
+
+out float maxDepth;
+
+uniform sampler2D depthMap;
+uniform int blockSize = 8; //OcclusionCuller::blockSize
+uniform float renderScale = 1.0; //the depth only covers the bottom left renderSize pixels
+uniform ivec2 renderSize;
+
+void main()
+{
+	ivec2 maxPixel = renderSize - 1;
+	vec2 tile = floor(gl_FragCoord.xy) * float(blockSize); //in screen pixels
+	ivec2 start = ivec2(floor(tile * renderScale));
+	ivec2 end = max(ivec2(ceil((tile + float(blockSize)) * renderScale)), start + 1); //every depth pixel the tile overlaps
+	float depth = 0.0;
+	for (int y = start.y; y < end.y; y++)
+	{
+		for (int x = start.x; x < end.x; x++)
+		{
+			depth = max(depth, texelFetch(depthMap, min(ivec2(x, y), maxPixel), 0).r); //clamp so edge tiles only see real pixels
+		}
+	}
+	maxDepth = depth;
+}
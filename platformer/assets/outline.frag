@@ -1,5 +1,15 @@
 #version 450 core
 
+//lit surface shading, specialised with defines by GetShaderVariant:
+//EMISSIVE skips the lighting and outputs the base color
+//NUM_LIGHTS sets how many point lights are summed, 0 compiles the loop out
+//DEFERRED shades a full screen pass from the G-buffer instead of a mesh, emissive pixels are passed through
+//POINT_LIGHT (with DEFERRED) shades one light volume from the PointLights buffer, blended on top of the sun
+
+#ifndef NUM_LIGHTS
+#define NUM_LIGHTS 1
+#endif
+
 struct Light
 {
 	vec3 pos;
@@ -7,50 +17,72 @@ struct Light
 	float constant;
     float linear;
     float quadratic;
+	float radius; //the deferred light volume's size
 };
 
-in vec4 sunFragPos;
+#ifdef DEFERRED
+uniform sampler2D depthMap;
+uniform sampler2D albedoMap;
+uniform sampler2D gNormalMap;
+uniform mat4 inverseMatrix; //clip space to world space
+uniform ivec2 renderSize;
+vec3 normal; //read from the G-buffer
+vec3 position; //..
+#else
 in vec3 normal;
 in vec3 position;
+#endif
+#ifdef POINT_LIGHT
+flat in int lightIndex;
+
+layout(std430, binding = 3) readonly buffer PointLights
+{
+	Light pointLights[];
+};
+#endif
 out vec4 color;
 
 uniform vec3 baseColor;
-uniform sampler2D normalMap;
-uniform sampler2D depthMap;
-uniform sampler2D shadowMap;
-uniform float lineThickness = 2;
-uniform float depthThresh = 0.05;
-uniform float threshViewAngleMul = 16.0;
-uniform float normThresh = 0.4;
-uniform float zNear = 0.1;
-uniform float zFar = 5.0;
-uniform vec3 outlineColor = vec3(0.05, 0.05, 0.05);
+
+#ifndef EMISSIVE
+uniform sampler2DArray shadowMap;
+#define MAX_CASCADES 4
+uniform mat4 sunMatrices[MAX_CASCADES];
+uniform int numCascades = 1;
 uniform vec3 sunPos;
 uniform vec3 camDir;
 uniform vec3 camPos;
 uniform vec3 sunColor = vec3(0.8, 0.8, 0.78);
-#define NUM_LIGHTS 1
+#if NUM_LIGHTS > 0
 uniform Light lights[NUM_LIGHTS];
-
-float linearize_depth(float d)
-{
-    float z_n = 2.0 * d - 1.0;
-    return 2.0 * zNear * zFar / (zFar + zNear - z_n * (zFar - zNear));
-} //Code from: https://stackoverflow.com/questions/51108596/linearize-depth
+#endif
 
 float SunShadow()
 { //adapted from https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping
-	vec3 coord = sunFragPos.xyz / sunFragPos.w;
-	coord = coord * 0.5 + 0.5; //convert NDC to tex coords
+	int cascade = -1;
+	vec3 coord = vec3(0.0);
+	for (int i = 0; i < numCascades; i++) //cascades go near to far so the first one containing us is the sharpest
+	{
+		vec4 sunFragPos = sunMatrices[i] * vec4(position, 1.0);
+		coord = sunFragPos.xyz / sunFragPos.w;
+		coord = coord * 0.5 + 0.5; //convert NDC to tex coords
+		if (all(greaterThanEqual(coord, vec3(0.0))) && all(lessThanEqual(coord, vec3(1.0))))
+		{
+			cascade = i;
+			break;
+		}
+	}
+	if (cascade < 0) //outside every cascade so treat as lit
+		return 1.0;
 	float result = 0.0;
-	vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
-    float pcfDepth = texture(shadowMap, coord.xy + vec2(-1, -1) * texelSize).x; //sample around the actual texel
+	vec2 texelSize = 1.0 / textureSize(shadowMap, 0).xy;
+    float pcfDepth = texture(shadowMap, vec3(coord.xy + vec2(-1, -1) * texelSize, cascade)).x; //sample around the actual texel
     result += coord.z > pcfDepth ? 1.0 : 0.0; //if the current depth is closer than closest depth then its not in shadow
-	pcfDepth = texture(shadowMap, coord.xy + vec2(-1, 1) * texelSize).x;
+	pcfDepth = texture(shadowMap, vec3(coord.xy + vec2(-1, 1) * texelSize, cascade)).x;
     result += coord.z > pcfDepth ? 1.0 : 0.0;
-	pcfDepth = texture(shadowMap, coord.xy + vec2(1, 1) * texelSize).x;
+	pcfDepth = texture(shadowMap, vec3(coord.xy + vec2(1, 1) * texelSize, cascade)).x;
     result += coord.z > pcfDepth ? 1.0 : 0.0;
-	pcfDepth = texture(shadowMap, coord.xy + vec2(1, -1) * texelSize).x;
+	pcfDepth = texture(shadowMap, vec3(coord.xy + vec2(1, -1) * texelSize, cascade)).x;
     result += coord.z > pcfDepth ? 1.0 : 0.0;
 	result /= 9.0; //convolution kernel magic
 	return clamp(1.0 - result, 0.0, 1.0);
@@ -83,52 +115,48 @@ vec3 PointLightDiffuse(Light light)
   			     light.quadratic * (dist * dist)); //replace line 105 with fma
 	return value * light.color * atten;
 }
-
-float Outline()
-{
-	//adapted from https://roystan.net/articles/outline-shader/
-	vec2 screenSize = textureSize(normalMap, 0);
-	vec2 screenPos = gl_FragCoord.xy/screenSize; //get frag screen position in range 0-1
-	float minusOffset = -floor(lineThickness * 0.5); //get pixel offset for "left" of line
-	float plusOffset = +floor(lineThickness * 0.5); //.. "right" ..
-	//float vNorm = dot(texture(normalMap, screenPos).rgb, -camDir);
-	float vNorm = (dot(normal, camDir) + 1.0) / 2; //replace with fma
-	vNorm = vNorm * threshViewAngleMul + 1.0;
-
-	vec2 uvBL = screenPos + vec2(minusOffset * 1.0/screenSize.x, minusOffset * 1.0/screenSize.y); //get point half thickness to bottom left
-	vec2 uvBR = screenPos + vec2(plusOffset * 1.0/screenSize.x, minusOffset * 1.0/screenSize.y); //.. br
-	vec2 uvTL = screenPos + vec2(minusOffset * 1.0/screenSize.x, plusOffset * 1.0/screenSize.y); //.. tl
-	vec2 uvTR = screenPos + vec2(plusOffset * 1.0/screenSize.x, plusOffset* 1.0/screenSize.y); //.. tr
-	float dBL = linearize_depth(texture(depthMap, uvBL).r); //sample the depth buffer in each offset and linearize it for consistent difference irrespective of depth
-	float dBR = linearize_depth(texture(depthMap, uvBR).r); //..
-	float dTL = linearize_depth(texture(depthMap, uvTL).r); //..
-	float dTR = linearize_depth(texture(depthMap, uvTR).r); //..
-	float depthDiff = length(vec2(dBL - dTR, dBR - dTL)); //get overall difference between points
-	depthDiff = depthDiff > depthThresh * vNorm ? 1.0 : 0.0;
-
-	vec3 nBL = texture(normalMap, uvBL).rgb;
-	vec3 nBR = texture(normalMap, uvBR).rgb;
-	vec3 nTL = texture(normalMap, uvTL).rgb;
-	vec3 nTR = texture(normalMap, uvTR).rgb;
-	float normDiff = sqrt(dot(nBL - nTR, nBL - nTR) + dot(nTL - nBR, nTL - nBR));
-	normDiff = normDiff > normThresh ? 1.0 : 0.0;
-	
-	return max(depthDiff, normDiff);
-}
-
+#endif
 
 void main()
 {
-	float outline = Outline();
-    vec3 diffuse = pow(baseColor, vec3(1.0/2.2)); //gamma correct the base color (colors from blender need correction)
-	vec3 albedo = fma(outlineColor, vec3(outline), diffuse * (1.0 - outline));
+#ifdef DEFERRED
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(depthMap, pixel, 0).r;
+	vec4 surface = texelFetch(albedoMap, pixel, 0);
+	if (depth >= 1.0) //sky, keep the clear color
+		discard;
+	vec3 albedo = surface.rgb; //already gamma corrected by the outline buffer
+	bool emissive = surface.a > 0.5;
+	normal = normalize(texelFetch(gNormalMap, pixel, 0).xyz * 2.0 - 1.0);
+	vec4 worldPosition = inverseMatrix * vec4(vec3(gl_FragCoord.xy / vec2(renderSize), depth) * 2.0 - 1.0, 1.0);
+	position = worldPosition.xyz / worldPosition.w;
+#else
+    vec3 albedo = pow(baseColor, vec3(1.0/2.2)); //gamma correct the base color (colors from blender need correction)
+	bool emissive = false;
+#endif
+#ifdef POINT_LIGHT
+	Light light = pointLights[lightIndex];
+	if (emissive || distance(light.pos, position) > light.radius) //outside the volume, only the screen rect was culled
+		discard;
+	color = vec4(albedo * PointLightDiffuse(light), 1.0); //added on with blending
+#elif defined(EMISSIVE)
+	color = vec4(albedo, 1.0);
+#else
+	if (emissive)
+	{
+		color = vec4(albedo, 1.0);
+		return;
+	}
 	vec3 sunLight = fma(SunShadow(), SunDiffuse(), SunSpecular()) * sunColor; //we multiply them because they are the same light
 	//SunShadow() gets the shadow from the shadow map, and SunDiffuse() calculates our shadow using sunPos
 	vec3 globalLight = vec3(0.1, 0.1, 0.1);
 	vec3 pointLights = vec3(0.0, 0.0, 0.0);
+#if NUM_LIGHTS > 0
 	for (int i = 0; i < NUM_LIGHTS; i++)
 	{
 		pointLights += PointLightDiffuse(lights[i]);
 	}
+#endif
 	color = vec4(albedo * (sunLight + globalLight + pointLights), 1.0);
+#endif
 }
\ No newline at end of file
@@ -1,9 +1,30 @@
 #version 450 core
 
+//DEFERRED also fills the rest of the G-buffer for the deferred lighting pass, EMISSIVE marks the surface as unlit
+
 in vec3 screenSpaceNormal;
-out vec4 color;
+in vec3 normal;
+layout(location = 0) out vec4 color;
+#ifdef DEFERRED
+layout(location = 1) out vec4 albedo; //rgb = gamma corrected base color, a = 1 if emissive
+layout(location = 2) out vec4 worldNormal; //xyz packed into 0-1
+
+uniform vec3 baseColor;
+#endif
+
+uniform vec3 camDir;
 
 void main()
 {
-	color = vec4(screenSpaceNormal, 1.0);
+	float vNorm = (dot(normalize(normal), camDir) + 1.0) / 2; //how much we face the camera, used by the outline pass to scale its depth threshold
+	color = vec4(screenSpaceNormal, vNorm);
+#ifdef DEFERRED
+	albedo.rgb = pow(baseColor, vec3(1.0/2.2)); //same correction as outline.frag
+#ifdef EMISSIVE
+	albedo.a = 1.0;
+#else
+	albedo.a = 0.0;
+#endif
+	worldNormal = vec4(normalize(normal) * 0.5 + 0.5, 0.0);
+#endif
 }
\ No newline at end of file
@@ -1,18 +0,0 @@
-#version 450 core
-
-layout(location = 0) in vec3 position;
-layout(location = 1) in vec3 norm;
-layout(location = 2) in vec3 nextPosition;
-layout(location = 3) in vec3 nextNorm;
-
-out vec3 screenSpaceNormal;
-
-uniform mat4 matrix;
-uniform mat4 model;
-uniform float animFac;
-
-void main()
-{
-	gl_Position = matrix * model * vec4(mix(position, nextPosition, animFac), 1.0);
-	screenSpaceNormal = (matrix * model * vec4(mix(norm, nextNorm, animFac), 0.0)).xyz;
-}
\ No newline at end of file
@@ -0,0 +1,63 @@
+#version 450 core
+
+out vec4 color;
+
+uniform sampler2D normalMap;
+uniform sampler2D depthMap;
+uniform sampler2D sceneMap;
+uniform float lineThickness = 2;
+uniform float depthThresh = 0.05;
+uniform float threshViewAngleMul = 16.0;
+uniform float normThresh = 0.4;
+uniform float zNear = 0.1;
+uniform float zFar = 5.0;
+uniform vec3 outlineColor = vec3(0.05, 0.05, 0.05);
+uniform float renderScale = 1.0; //the scene was drawn into the bottom left renderSize pixels of its targets
+uniform ivec2 renderSize;
+
+float linearize_depth(float d)
+{
+    float z_n = 2.0 * d - 1.0;
+    return 2.0 * zNear * zFar / (zFar + zNear - z_n * (zFar - zNear));
+} //Code from: https://stackoverflow.com/questions/51108596/linearize-depth
+
+float Outline(ivec2 pixel)
+{
+	//adapted from https://roystan.net/articles/outline-shader/
+	ivec2 minusOffset = ivec2(-floor(lineThickness * 0.5)); //get pixel offset for "left" of line
+	ivec2 plusOffset = ivec2(floor(lineThickness * 0.5)); //.. "right" ..
+	float vNorm = texelFetch(normalMap, pixel, 0).a; //outline buffer stores how much the surface faces the camera in alpha
+	vNorm = vNorm * threshViewAngleMul + 1.0;
+
+	ivec2 maxPixel = renderSize - 1;
+	ivec2 pBL = clamp(pixel + ivec2(minusOffset.x, minusOffset.y), ivec2(0), maxPixel); //get point half thickness to bottom left
+	ivec2 pBR = clamp(pixel + ivec2(plusOffset.x, minusOffset.y), ivec2(0), maxPixel); //.. br
+	ivec2 pTL = clamp(pixel + ivec2(minusOffset.x, plusOffset.y), ivec2(0), maxPixel); //.. tl
+	ivec2 pTR = clamp(pixel + ivec2(plusOffset.x, plusOffset.y), ivec2(0), maxPixel); //.. tr
+	float dBL = linearize_depth(texelFetch(depthMap, pBL, 0).r); //sample the depth buffer in each offset and linearize it for consistent difference irrespective of depth
+	float dBR = linearize_depth(texelFetch(depthMap, pBR, 0).r); //..
+	float dTL = linearize_depth(texelFetch(depthMap, pTL, 0).r); //..
+	float dTR = linearize_depth(texelFetch(depthMap, pTR, 0).r); //..
+	float depthDiff = length(vec2(dBL - dTR, dBR - dTL)); //get overall difference between points
+	depthDiff = depthDiff > depthThresh * vNorm ? 1.0 : 0.0;
+
+	vec3 nBL = texelFetch(normalMap, pBL, 0).rgb;
+	vec3 nBR = texelFetch(normalMap, pBR, 0).rgb;
+	vec3 nTL = texelFetch(normalMap, pTL, 0).rgb;
+	vec3 nTR = texelFetch(normalMap, pTR, 0).rgb;
+	float normDiff = sqrt(dot(nBL - nTR, nBL - nTR) + dot(nTL - nBR, nTL - nBR));
+	normDiff = normDiff > normThresh ? 1.0 : 0.0;
+	
+	return max(depthDiff, normDiff);
+}
+
+void main()
+{
+	vec2 scenePosition = gl_FragCoord.xy * renderScale;
+	ivec2 pixel = ivec2(scenePosition);
+	vec2 uv = clamp(scenePosition, vec2(0.5), vec2(renderSize) - 0.5) / vec2(textureSize(sceneMap, 0)); //keep the filter inside the drawn area
+	vec3 scene = texture(sceneMap, uv).rgb; //bilinear upscale
+	if (texelFetch(depthMap, pixel, 0).r < 1.0 && Outline(pixel) > 0.5) //only outline pixels covered by an object, like the old per object pass
+		scene = outlineColor;
+	color = vec4(scene, 1.0);
+}
@@ -0,0 +1,53 @@
+#version 450 core
+
+//one screen space rect per deferred point light, covering where its sphere can light
+//drawn as a 4 vertex triangle strip per instance with no attributes
+
+struct Light
+{
+	vec3 pos;
+	vec3 color;
+	float constant;
+	float linear;
+	float quadratic;
+	float radius;
+};
+
+layout(std430, binding = 3) readonly buffer PointLights
+{
+	Light pointLights[];
+};
+
+flat out int lightIndex;
+
+uniform mat4 matrix;
+
+void main()
+{
+	lightIndex = gl_InstanceID;
+	Light light = pointLights[gl_InstanceID];
+	vec2 minCorner = vec2(1.0);
+	vec2 maxCorner = vec2(-1.0);
+	bool behind = false;
+	for (int i = 0; i < 8; i++) //project the corners of the sphere's box
+	{
+		vec3 offset = vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 corner = matrix * vec4(light.pos + offset * light.radius, 1.0);
+		if (corner.w <= 0.0)
+		{
+			behind = true;
+			break;
+		}
+		minCorner = min(minCorner, corner.xy / corner.w);
+		maxCorner = max(maxCorner, corner.xy / corner.w);
+	}
+	if (behind) //the camera is inside or near the box, cover the screen
+	{
+		minCorner = vec2(-1.0);
+		maxCorner = vec2(1.0);
+	}
+	minCorner = clamp(minCorner, vec2(-1.0), vec2(1.0));
+	maxCorner = clamp(maxCorner, minCorner, vec2(1.0)); //empty rects collapse to nothing
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1); //(0,0) (1,0) (0,1) (1,1)
+	gl_Position = vec4(mix(minCorner, maxCorner, corner), 0.0, 1.0);
+}
@@ -0,0 +1,72 @@
+#version 450 core
+
+//every mesh vertex shader, specialised with defines by GetShaderVariant:
+//SHADOW_ONLY only outputs the position, for the shadow maps
+//OUTLINE_BUFFER outputs the screen space normal for the outline buffer instead of the world position
+//ANIMATED blends towards the next frame's attributes by animFac
+//PARTICLE reads each instance's model matrix from the particle SSBO
+
+invariant gl_Position; //the main pass depth tests against the outline buffer's depth with GL_LEQUAL so positions must match exactly
+
+layout(location = 0) in vec3 pos;
+#ifndef SHADOW_ONLY
+layout(location = 1) in vec3 norm;
+#endif
+#ifdef ANIMATED
+layout(location = 2) in vec3 nextPos;
+#ifndef SHADOW_ONLY
+layout(location = 3) in vec3 nextNorm;
+#endif
+uniform float animFac;
+#endif
+
+#ifdef PARTICLE
+layout(std430, binding = 2) readonly buffer ParticleModels
+{
+	mat4 particleModels[];
+};
+uniform uint firstParticle;
+uniform uint particleCapacity;
+#else
+uniform mat4 model;
+#endif
+
+#ifdef SHADOW_ONLY
+uniform mat4 sunMatrix;
+#else
+uniform mat4 matrix;
+out vec3 normal;
+#ifdef OUTLINE_BUFFER
+out vec3 screenSpaceNormal;
+#else
+out vec3 position;
+#endif
+#endif
+
+void main()
+{
+#ifdef PARTICLE
+	mat4 model = particleModels[(firstParticle + gl_InstanceID) % particleCapacity];
+#endif
+#ifdef ANIMATED
+	vec3 localPos = mix(pos, nextPos, animFac);
+#else
+	vec3 localPos = pos;
+#endif
+#ifdef SHADOW_ONLY
+	gl_Position = sunMatrix * model * vec4(localPos, 1.0);
+#else
+#ifdef ANIMATED
+	vec3 localNorm = mix(norm, nextNorm, animFac);
+#else
+	vec3 localNorm = norm;
+#endif
+	gl_Position = matrix * model * vec4(localPos, 1.0);
+	normal = normalize((model * vec4(localNorm, 0.0)).xyz);
+#ifdef OUTLINE_BUFFER
+	screenSpaceNormal = (matrix * model * vec4(localNorm, 0.0)).xyz;
+#else
+	position = (model * vec4(localPos, 1.0)).xyz;
+#endif
+#endif
+}
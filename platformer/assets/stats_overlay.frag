@@ -0,0 +1,39 @@
+#version 450 core
+
+//text from a built in 3x5 font, each character sits in a 4x6 cell so neighbours don't touch
+
+layout(std430, binding = 4) readonly buffer Text
+{
+	uint text[]; //4 characters per uint, the first in the low byte
+};
+
+uniform ivec2 gridSize;
+uniform int scale;
+uniform ivec2 screenSize;
+
+out vec4 color;
+
+//ASCII 32 (space) to 90 (Z), 3 bits per row top row first, the left pixel is the high bit
+const uint font[59] = uint[59](
+	0x0000u, 0x2482u, 0x5A00u, 0x5F7Du, 0x3C9Eu, 0x52A5u, 0x2AABu, 0x2400u,
+	0x1491u, 0x4494u, 0x0AA8u, 0x05D0u, 0x0014u, 0x01C0u, 0x0002u, 0x12A4u,
+	0x7B6Fu, 0x2C97u, 0x73E7u, 0x72CFu, 0x5BC9u, 0x79CFu, 0x79EFu, 0x7292u,
+	0x7BEFu, 0x7BCFu, 0x0410u, 0x0414u, 0x1511u, 0x0E38u, 0x4454u, 0x72C2u,
+	0x7BE7u, 0x2BEDu, 0x6BAEu, 0x3923u, 0x6B6Eu, 0x79A7u, 0x79A4u, 0x396Bu,
+	0x5BEDu, 0x7497u, 0x126Au, 0x5BADu, 0x4927u, 0x5FEDu, 0x6B6Du, 0x2B6Au,
+	0x6BA4u, 0x2B73u, 0x6BADu, 0x388Eu, 0x7492u, 0x5B6Fu, 0x5B6Au, 0x5BFDu,
+	0x5AADu, 0x5A92u, 0x72A7u
+);
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.x, float(screenSize.y) - gl_FragCoord.y) / scale; //font pixels from the top left
+	ivec2 cell = min(pixel / ivec2(4, 6), gridSize - 1);
+	ivec2 inCell = pixel - cell * ivec2(4, 6);
+	int index = cell.y * gridSize.x + cell.x;
+	uint character = (text[index >> 2] >> ((index & 3) * 8)) & 0xFFu;
+	bool lit = false;
+	if (inCell.x < 3 && inCell.y < 5 && character >= 32u && character <= 90u)
+		lit = ((font[character - 32u] >> uint(14 - (inCell.y * 3 + inCell.x))) & 1u) != 0u;
+	color = lit ? vec4(1.0) : vec4(0.0, 0.0, 0.0, 0.6);
+}
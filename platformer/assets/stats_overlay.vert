@@ -0,0 +1,14 @@
+#version 450 core
+
+//one quad over the text grid in the top left corner of the screen, drawn with DrawInstancedQuads(1)
+
+uniform ivec2 gridSize; //columns, rows
+uniform int scale; //screen pixels per font pixel
+uniform ivec2 screenSize;
+
+void main()
+{
+	vec2 corner = vec2(gl_VertexID >> 1, gl_VertexID & 1); //(0,0) (0,1) (1,0) (1,1), counter clockwise once y is flipped
+	vec2 pixels = corner * vec2(gridSize * ivec2(4, 6) * scale); //from the top left
+	gl_Position = vec4(pixels.x / float(screenSize.x) * 2.0 - 1.0, 1.0 - pixels.y / float(screenSize.y) * 2.0, 0.0, 1.0);
+}
@@ -142,6 +142,9 @@ protected:
 	glm::mat4 view;
 	glm::mat4 projection;
 	glm::vec3 forward;
+	float fieldOfView = glm::radians(45.f);
+	float nearPlane = 0.1f;
+	float farPlane = 40.00f;
 
 	glm::mat4 LookAt(glm::vec3 target)
 	{
@@ -165,7 +168,7 @@ protected:
 
 	glm::mat4 Project()
 	{
-		return glm::perspective(glm::radians(45.f), screenWidth / screenHeight, 0.1f, 40.00f);
+		return glm::perspective(fieldOfView, screenWidth / screenHeight, nearPlane, farPlane);
 	}
 
 public:
@@ -218,6 +221,12 @@ public:
 		return position;
 	}
 
+	//world space position of the eye, GetPosition() is only the offset from the target
+	glm::vec3 GetEyePosition()
+	{
+		return glm::vec3(glm::inverse(view)[3]);
+	}
+
 	glm::mat4 GetView()
 	{
 		return view;
@@ -242,6 +251,78 @@ public:
 	{
 		distance += amt;
 	}
+
+	float GetFieldOfView()
+	{
+		return fieldOfView;
+	}
+
+	float GetNearPlane()
+	{
+		return nearPlane;
+	}
+
+	float GetFarPlane()
+	{
+		return farPlane;
+	}
+
+	//pixels one world unit covers at a distance of one, for screen space error
+	float GetPixelsPerUnit()
+	{
+		return screenHeight / (2.00f * tanf(fieldOfView * 0.50f));
+	}
+
+	float GetAspect()
+	{
+		return screenWidth / screenHeight;
+	}
+};
+
+//one point on a CameraPath, in the same terms the camera orbits its target in
+struct CameraKey
+{
+	float time; //seconds from the start of the path
+	glm::vec3 target;
+	float angle; //radians, not wrapped so a key can carry on round past 2 PI
+	float inclination; //..
+	float distance;
+};
+
+//a scripted camera move, keys are linearly interpolated so the same time always gives the same view
+class CameraPath
+{
+protected:
+	std::vector<CameraKey> keys;
+
+public:
+	//keys must be added in time order
+	void AddKey(float time, glm::vec3 target, float angle, float inclination, float distance)
+	{
+		keys.push_back(CameraKey{ time, target, angle, inclination, distance });
+	}
+
+	//place the camera where the path is at time, clamped to the first and last keys
+	void Apply(Camera* camera, float time)
+	{
+		if (keys.empty())
+			return;
+		unsigned int next = 0;
+		while (next < keys.size() && keys[next].time < time)
+			next++;
+		CameraKey& a = keys[next == 0 ? 0 : next - 1];
+		CameraKey& b = keys[next == keys.size() ? keys.size() - 1 : next];
+		float t = b.time > a.time ? glm::clamp((time - a.time) / (b.time - a.time), 0.00f, 1.00f) : 0.00f;
+		camera->SetAngle(glm::mix(a.angle, b.angle, t));
+		camera->SetInclination(glm::mix(a.inclination, b.inclination, t));
+		camera->SetDistance(glm::mix(a.distance, b.distance, t));
+		camera->Follow(glm::mix(a.target, b.target, t));
+	}
+
+	float GetDuration()
+	{
+		return keys.empty() ? 0.00f : keys.back().time;
+	}
 };
 
 class File
@@ -286,27 +367,277 @@ public:
 	};
 };
 
+unsigned long long HashBytes(const char* data, unsigned long long size, unsigned long long hash = 14695981039346656037ull)
+{
+	for (unsigned long long i = 0; i < size; i++) //FNV-1a
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//linked program binaries on disk so later launches skip compiling
+//keyed by a hash of the sources, defines and driver, so editing a shader or updating the driver just misses and recompiles
+class ShaderCache
+{
+protected:
+	struct CacheHeader
+	{
+		unsigned int magic;
+		unsigned long long key;
+		GLenum binaryFormat;
+		unsigned int length;
+	};
+
+	static constexpr unsigned int magic = 0x31435342; //"BSC1", bump when the file layout changes
+	std::string directory;
+	std::string driver; //vendor, renderer and version, binaries are only valid for the driver that made them
+	bool enabled = false;
+	unsigned int hits = 0;
+	unsigned int misses = 0;
+
+	std::string GetFilePath(unsigned long long key)
+	{
+		std::stringstream name;
+		name << std::hex << key << ".bin";
+		return directory + name.str();
+	}
+
+public:
+	ShaderCache()
+	{
+		int numFormats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		if (numFormats == 0)
+		{
+			std::cout << "Warning: Driver has no program binary formats, shaders won't be cached!\n";
+			return;
+		}
+		char* prefPath = SDL_GetPrefPath("AB", "Platformer"); //writable even when the game is installed somewhere read only
+		if (prefPath == nullptr)
+			return;
+		directory = std::string(prefPath) + "shader_cache/";
+		SDL_free(prefPath);
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if (error)
+		{
+			std::cout << "Warning: Couldn't create the shader cache at " << directory << "!\n";
+			return;
+		}
+		const char* strings[] = { (const char*)glGetString(GL_VENDOR), (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION) };
+		for (const char* string : strings)
+		{
+			if (string != nullptr)
+				driver += std::string(string) + "\n";
+		}
+		enabled = true;
+	}
+
+	//sources can contain nullptrs for empty files
+	unsigned long long GetKey(std::vector<const char*> sources, const char* defines)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		hash = HashBytes(driver.c_str(), driver.size(), hash);
+		hash = HashBytes(defines, strlen(defines) + 1, hash); //include the terminator so moving text between strings changes the hash
+		for (const char* source : sources)
+		{
+			if (source != nullptr)
+				hash = HashBytes(source, strlen(source) + 1, hash);
+		}
+		return hash;
+	}
+
+	//create a program from the cached binary, returns 0 on a miss or if the driver rejects the binary
+	glm::uint Load(unsigned long long key)
+	{
+		if (!enabled)
+		{
+			misses++;
+			return 0;
+		}
+		std::ifstream file(GetFilePath(key), std::ios::in | std::ios::binary);
+		CacheHeader header;
+		if (!file.is_open() || !file.read(reinterpret_cast<char*>(&header), sizeof(CacheHeader)) || header.magic != magic || header.key != key)
+		{
+			misses++;
+			return 0;
+		}
+		std::vector<char> binary = std::vector<char>(header.length);
+		if (!file.read(binary.data(), header.length))
+		{
+			misses++;
+			return 0;
+		}
+		glm::uint program = glCreateProgram();
+		glProgramBinary(program, header.binaryFormat, binary.data(), header.length);
+		int linked = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE) //e.g. the driver changed its format without changing its version string
+		{
+			glDeleteProgram(program);
+			misses++;
+			return 0;
+		}
+		hits++;
+		return program;
+	}
+
+	//save a linked program, it must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+	void Store(unsigned long long key, glm::uint program)
+	{
+		if (!enabled)
+			return;
+		int length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		CacheHeader header;
+		header.magic = magic;
+		header.key = key;
+		header.length = 0;
+		std::vector<char> binary = std::vector<char>(length);
+		glGetProgramBinary(program, length, reinterpret_cast<int*>(&header.length), &header.binaryFormat, binary.data());
+		if (header.length == 0)
+			return;
+		std::ofstream file(GetFilePath(key), std::ios::out | std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<char*>(&header), sizeof(CacheHeader));
+		file.write(binary.data(), header.length);
+	}
+
+	bool IsEnabled()
+	{
+		return enabled;
+	}
+
+	unsigned int GetHits()
+	{
+		return hits;
+	}
+
+	unsigned int GetMisses()
+	{
+		return misses;
+	}
+};
+
+ShaderCache* shaderCache = nullptr; //nullptr to always compile
+
+class Shader;
+std::vector<Shader*> pendingShaders; //shaders whose compile results haven't been checked yet
+unsigned long long int shaderFinishTicks = 0; //performance counter ticks spent in Shader::Finish, this is where we wait on the driver
+
+//compiles are only issued when a Shader is created, the results are checked the first time the program is needed
+//so the driver can build every program at once (on its own threads with GL_KHR_parallel_shader_compile) while init does other work
 class Shader
 {
 protected:
 	glm::uint program = 0;
+	glm::uint vertexShader = 0; //only kept while pending
+	glm::uint fragmentShader = 0; //..
+	unsigned long long cacheKey = 0;
+	bool pending = false;
+	int numLights = 1; //size of the lights array, from NUM_LIGHTS, outline.frag defaults to 1
+
+	//give a source the defines by putting them straight after its #version line, #line keeps the error line numbers right
+	static void SetSource(glm::uint shader, const char* source, std::string& defines)
+	{
+		if (source == nullptr || defines.empty())
+		{
+			glShaderSource(shader, 1, &source, NULL);
+			return;
+		}
+		const char* body = source;
+		if (strncmp(source, "#version", 8) == 0)
+		{
+			const char* lineEnd = strchr(source, '\n');
+			body = lineEnd != nullptr ? lineEnd + 1 : source + strlen(source);
+		}
+		std::string version = std::string(source, body - source);
+		std::string header = defines + "#line " + std::to_string(version.empty() ? 1 : 2) + "\n";
+		const char* strings[] = { version.c_str(), header.c_str(), body };
+		glShaderSource(shader, 3, strings, NULL);
+	}
 
 public:
-	Shader(const char* vertexPath, const char* fragmentPath)
+	//turn "NAME" or "NAME=VALUE" entries into a sorted #define block, so the same set always gives the same text
+	static std::string MakeDefines(std::vector<std::string> defines)
+	{
+		std::sort(defines.begin(), defines.end());
+		defines.erase(std::unique(defines.begin(), defines.end()), defines.end());
+		std::string result;
+		for (std::string define : defines)
+		{
+			if (define.empty()) //lets callers switch a define off with ""
+				continue;
+			std::replace(define.begin(), define.end(), '=', ' ');
+			result += "#define " + define + "\n";
+		}
+		return result;
+	}
+
+	//defines are injected into both stages, see MakeDefines
+	Shader(const char* vertexPath, const char* fragmentPath, std::vector<std::string> defines = {})
 	{
 		File* vertexFile = new File(vertexPath);
 		File* fragmentFile = new File(fragmentPath);
-		glm::uint vertexShader = glCreateShader(GL_VERTEX_SHADER); //init empty shader
-		glm::uint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER); //..
-		glShaderSource(vertexShader, 1, vertexFile->GetDataPointer(), NULL); //load shader source
+		std::string defineBlock = MakeDefines(defines);
+		for (std::string& define : defines)
+		{
+			if (define.rfind("NUM_LIGHTS=", 0) == 0)
+				numLights = glm::max(atoi(define.c_str() + 11), 0);
+		}
+		if (shaderCache != nullptr)
+		{
+			cacheKey = shaderCache->GetKey({ vertexFile->GetData(), fragmentFile->GetData() }, defineBlock.c_str());
+			program = shaderCache->Load(cacheKey);
+			if (program != 0) //cache hit, nothing to compile
+			{
+				delete vertexFile;
+				delete fragmentFile;
+				return;
+			}
+		}
+		vertexShader = glCreateShader(GL_VERTEX_SHADER); //init empty shader
+		fragmentShader = glCreateShader(GL_FRAGMENT_SHADER); //..
+		SetSource(vertexShader, vertexFile->GetData(), defineBlock); //load shader source
 		glCompileShader(vertexShader); //compile shader source
-		glShaderSource(fragmentShader, 1, fragmentFile->GetDataPointer(), NULL); //..
+		SetSource(fragmentShader, fragmentFile->GetData(), defineBlock); //..
 		glCompileShader(fragmentShader); //..
 
 		program = glCreateProgram(); //init empty program
 		glAttachShader(program, vertexShader); //attach shaders
 		glAttachShader(program, fragmentShader); //..
-		glLinkProgram(program); //link program
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE); //so the shader cache can read it back
+		glLinkProgram(program); //link program, returns straight away, the driver finishes it in the background
+		pending = true;
+		pendingShaders.push_back(this);
+		delete vertexFile;
+		delete fragmentFile;
+	}
+
+	//true once the driver has finished compiling and linking, never blocks
+	bool IsReady()
+	{
+		if (!pending)
+			return true;
+		if (!GLEW_KHR_parallel_shader_compile) //no way to ask without waiting
+			return false;
+		int complete = 0;
+		glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+		return complete == GL_TRUE;
+	}
+
+	//check the compile results, blocks until the driver is done with us
+	void Finish()
+	{
+		if (!pending)
+			return;
+		unsigned long long int start = SDL_GetPerformanceCounter();
+		pending = false;
+		pendingShaders.erase(std::remove(pendingShaders.begin(), pendingShaders.end(), this), pendingShaders.end());
+		glm::uint linkedProgram = program;
 
 		//log errors:
 		int logSize = 0;
@@ -331,10 +662,16 @@ public:
 		}
 		delete[] log;
 
+		int linked = 0;
+		glGetProgramiv(linkedProgram, GL_LINK_STATUS, &linked);
+		if (shaderCache != nullptr && program == linkedProgram && linked == GL_TRUE) //only cache programs that built cleanly
+			shaderCache->Store(cacheKey, program);
+
 		glDeleteShader(vertexShader); //cleanup shaders as they are contained in the program
 		glDeleteShader(fragmentShader); //..
-		delete vertexFile;
-		delete fragmentFile;
+		vertexShader = 0;
+		fragmentShader = 0;
+		shaderFinishTicks += SDL_GetPerformanceCounter() - start;
 	}
 
 	Shader(bool isErrorShader)
@@ -375,8 +712,8 @@ public:
 
 	void SetUniforms()
 	{
+		Finish();
 		glm::uint oldProgram = 0;
-		constexpr int numLights = 1;
 		glGetIntegerv(GL_CURRENT_PROGRAM, reinterpret_cast<int*>(&oldProgram)); //get the active program
 		glUseProgram(program); //use our prog
 		glUniformMatrix4fv(glGetUniformLocation(program, "matrix"), 1, false, glm::value_ptr(mainCamera->GetCombinedMatrix())); //set the uniforms
@@ -386,21 +723,23 @@ public:
 		glUniform1i(glGetUniformLocation(program, "normalMap"), 3);
 		glUniform1i(glGetUniformLocation(program, "depthMap"), 4);
 
-		for (int i = 0; i < numLights; i++)
+		for (int i = 0; i < numLights; i++) //only the scene light exists, the rest are black so they add nothing
 		{
-			float lightIntensity = 0.4f;
 			std::string uniformName = "lights[" + std::to_string(i) + "]";
-			glUniform3f(glGetUniformLocation(program, (uniformName + ".position").c_str()), 0.5f * lightIntensity, 1.5f * lightIntensity, 0.5f * lightIntensity);
-			glUniform3f(glGetUniformLocation(program, (uniformName + ".color").c_str()), 1.0f, 0.2f, 0.2f);
-			glUniform1f(glGetUniformLocation(program, (uniformName + ".constant").c_str()), 1.0f);
-			glUniform1f(glGetUniformLocation(program, (uniformName + ".linear").c_str()), 0.12f);
-			glUniform1f(glGetUniformLocation(program, (uniformName + ".quadratic").c_str()), 2.00f);
+			glm::vec3 color = i == 0 ? SCENE_LIGHT_COLOR : glm::vec3(0.00f);
+			glm::vec3 attenuation = i == 0 ? SCENE_LIGHT_ATTENUATION : glm::vec3(1.00f, 0.00f, 0.00f); //a constant of 1 keeps the falloff from dividing by 0
+			glUniform3fv(glGetUniformLocation(program, (uniformName + ".pos").c_str()), 1, glm::value_ptr(SCENE_LIGHT_POSITION));
+			glUniform3fv(glGetUniformLocation(program, (uniformName + ".color").c_str()), 1, glm::value_ptr(color));
+			glUniform1f(glGetUniformLocation(program, (uniformName + ".constant").c_str()), attenuation.x);
+			glUniform1f(glGetUniformLocation(program, (uniformName + ".linear").c_str()), attenuation.y);
+			glUniform1f(glGetUniformLocation(program, (uniformName + ".quadratic").c_str()), attenuation.z);
 		}
 		glUseProgram(oldProgram); //activate the previously active prog
 	}
 
 	void SetUniforms(glm::mat4 sunMatrix, glm::vec3 sunPos)
 	{
+		Finish();
 		glm::uint oldProgram = 0;
 		glGetIntegerv(GL_CURRENT_PROGRAM, reinterpret_cast<int*>(&oldProgram)); //get the active program
 		glUseProgram(program); //use our prog
@@ -413,16 +752,21 @@ public:
 
 	glm::uint GetProgram()
 	{
+		if (pending) //first use, wait for the driver
+			Finish();
 		return program;
 	}
 
 	void Use()
 	{
+		if (pending)
+			Finish();
 		glUseProgram(program);
 	}
 
 	~Shader()
 	{
+		Finish();
 		if (this != errorShader && errorShader != nullptr) //if we aren't deleting the error shader and the error shader exists
 		{
 			if (program == errorShader->GetProgram()) //if this program is not the error shader 
@@ -433,6 +777,110 @@ public:
 	}
 };
 
+std::unordered_map<unsigned long long, Shader*> shaderVariants; //every variant made by GetShaderVariant, keyed by sources and defines
+
+//get the program built from these sources with these defines ("ANIMATED", "NUM_LIGHTS=2"...)
+//asking for the same combination again, in any order, returns the same Shader so each variant is only compiled once
+Shader* GetShaderVariant(const char* vertexPath, const char* fragmentPath, std::vector<std::string> defines = {})
+{
+	std::string description = std::string(vertexPath) + "\n" + fragmentPath + "\n" + Shader::MakeDefines(defines);
+	unsigned long long key = HashBytes(description.c_str(), description.size());
+	std::unordered_map<unsigned long long, Shader*>::iterator existing = shaderVariants.find(key);
+	if (existing != shaderVariants.end())
+		return existing->second;
+	Shader* shader = new Shader(vertexPath, fragmentPath, defines);
+	shaderVariants[key] = shader;
+	return shader;
+}
+
+//finish the shaders the driver is already done with, never blocks so call it between other init work
+void PollShaders()
+{
+	for (unsigned long long int i = pendingShaders.size(); i-- > 0;) //Finish removes from the list
+	{
+		if (pendingShaders[i]->IsReady())
+			pendingShaders[i]->Finish();
+	}
+}
+
+//wait for every shader still building
+void FinishShaders()
+{
+	while (!pendingShaders.empty())
+		pendingShaders.back()->Finish();
+}
+
+class ComputeShader
+{
+protected:
+	glm::uint program = 0;
+	bool valid = false;
+
+public:
+	ComputeShader(const char* path)
+	{
+		File* file = new File(path);
+		unsigned long long cacheKey = 0;
+		if (shaderCache != nullptr)
+		{
+			cacheKey = shaderCache->GetKey({ file->GetData() }, "");
+			program = shaderCache->Load(cacheKey);
+			if (program != 0)
+			{
+				valid = true;
+				delete file;
+				return;
+			}
+		}
+		glm::uint shader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(shader, 1, file->GetDataPointer(), NULL);
+		glCompileShader(shader);
+		program = glCreateProgram();
+		glAttachShader(program, shader);
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program);
+
+		int compiled = 0;
+		int linked = 0;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		int logSize = 0;
+		char* log = new char[1024];
+		glGetShaderInfoLog(shader, 1024, &logSize, log);
+		if (logSize > 0)
+			std::cout << "Compute Errors:\n" << log << "\n";
+		delete[] log;
+		valid = compiled == GL_TRUE && linked == GL_TRUE;
+		if (shaderCache != nullptr && valid)
+			shaderCache->Store(cacheKey, program);
+
+		glDeleteShader(shader);
+		delete file;
+	}
+
+	~ComputeShader()
+	{
+		glDeleteProgram(program);
+	}
+
+	//run groupsX work groups, callers need their own glMemoryBarrier before using the results
+	void Dispatch(unsigned int groupsX)
+	{
+		glUseProgram(program);
+		glDispatchCompute(groupsX, 1, 1);
+	}
+
+	bool IsValid()
+	{
+		return valid;
+	}
+
+	glm::uint GetProgram()
+	{
+		return program;
+	}
+};
+
 class Texture
 {
 protected:
@@ -567,6 +1015,54 @@ public:
 	{
 		return texture;
 	}
+
+	int GetWidth()
+	{
+		return width;
+	}
+
+	int GetHeight()
+	{
+		return height;
+	}
+
+	GLenum GetFormat()
+	{
+		return GLFormat;
+	}
+};
+
+//array of textures with the same size and format, used for the shadow cascades
+class TextureArray : public Texture
+{
+protected:
+	int layers;
+
+public:
+	TextureArray(int _width, int _height, int _layers, GLenum internalFormat)
+	{
+		width = _width;
+		height = _height;
+		layers = _layers;
+		unsigned int oldTexture = 0;
+		glGetIntegerv(GL_ACTIVE_TEXTURE, reinterpret_cast<int*>(&oldTexture));
+		glActiveTexture(GL_TEXTURE8); //select texture unit 8 (we have this reserved for creating textures)
+		glGenTextures(1, &texture); //gen empty tex
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture); //bind it
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); //set wrapping values
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE); //..
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST); //depth is compared in the shader so don't filter it
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST); //..
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, internalFormat, width, height, layers); //allocate memory (no mipmaps)
+		glActiveTexture(oldTexture);
+		GLFormat = internalFormat;
+		successful = true;
+	}
+
+	int GetLayers()
+	{
+		return layers;
+	}
 };
 
 class GLFramebuffer
@@ -583,7 +1079,7 @@ public:
 	GLFramebuffer()
 	{
 		glGenFramebuffers(1, &framebuffer);
-		color = new Texture((int)screenWidth, (int)screenHeight, GL_RGB, GL_UNSIGNED_BYTE); //create a texture for the color attachment
+		color = new Texture((int)screenWidth, (int)screenHeight, GL_RGBA, GL_UNSIGNED_BYTE); //create a texture for the color attachment (alpha is used by the outline pass)
 		depth = new Texture((int)screenWidth, (int)screenHeight, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT); //create a depth texture
 		width = (int)screenWidth;
 		height = (int)screenHeight;
@@ -663,161 +1159,2625 @@ public:
 	}
 };
 
-class GLBuffer
+//a tightly packed RGB8 image, top row first, used to dump frames and compare them against reference images
+class FrameImage
 {
 protected:
-	glm::uint buffer = 0;
-	unsigned int size = 0;
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> pixels;
 
 public:
-	GLBuffer(void* data, unsigned int _size)
+	FrameImage()
 	{
-		glCreateBuffers(1, &buffer); //generate and initalize buffer
-		glNamedBufferData(buffer, _size, data, GL_STATIC_DRAW); //populate it
-		size = _size;
 	}
 
-	GLBuffer(const GLBuffer& other)
+	//read back the base level of a color texture, waits for the GPU to finish drawing it
+	FrameImage(Texture* texture)
 	{
-		unsigned int _size = other.size;
-		glCreateBuffers(1, &buffer); //generate and initalize our buffer
-		glNamedBufferData(buffer, _size, (void*)0, GL_STATIC_DRAW); //populate our buffer with empty data
-		glCopyNamedBufferSubData(other.buffer, buffer, 0, 0, _size); //copy other.buffer into buffer
-		size = _size;
+		width = texture->GetWidth();
+		height = texture->GetHeight();
+		std::vector<unsigned char> flipped = std::vector<unsigned char>(width * height * 3);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1); //rows aren't padded to 4 bytes
+		glGetTextureImage(texture->GetTexture(), 0, GL_RGB, GL_UNSIGNED_BYTE, (int)flipped.size(), flipped.data());
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		pixels.resize(flipped.size());
+		int rowSize = width * 3;
+		for (int y = 0; y < height; y++) //GL's first row is the bottom one
+			memcpy(&pixels[y * rowSize], &flipped[(height - 1 - y) * rowSize], rowSize);
 	}
 
-	GLBuffer()
+	//binary PPM, no compression but anything can open it and it needs no extra library
+	bool Save(const char* path)
 	{
-		buffer = 0;
-		size = 0;
+		std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cout << "Error: Couldn't write " << path << "!\n";
+			return false;
+		}
+		file << "P6\n" << width << " " << height << "\n255\n";
+		file.write(reinterpret_cast<char*>(pixels.data()), pixels.size());
+		return true;
 	}
 
-	~GLBuffer()
+	//only reads the binary PPMs Save writes
+	bool Load(const char* path)
 	{
-		glDeleteBuffers(1, &buffer);
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		std::string magic;
+		int maxValue = 0;
+		if (!file.is_open() || !(file >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255 || width <= 0 || height <= 0)
+		{
+			width = 0;
+			height = 0;
+			return false;
+		}
+		file.get(); //the single whitespace after the header
+		pixels.resize(width * height * 3);
+		return (bool)file.read(reinterpret_cast<char*>(pixels.data()), pixels.size());
 	}
 
-	glm::uint const GetBuffer()
+	//fraction of pixels with a channel more than tolerance away from other's, 1 if the sizes differ
+	float Compare(FrameImage& other, int tolerance, float* rmse = nullptr)
 	{
-		return buffer;
+		if (width != other.width || height != other.height || pixels.size() != other.pixels.size())
+		{
+			if (rmse != nullptr)
+				*rmse = 255.00f;
+			return 1.00f;
+		}
+		unsigned long long mismatched = 0;
+		double squaredError = 0.00;
+		for (unsigned long long i = 0; i < pixels.size(); i += 3)
+		{
+			int worst = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				int difference = abs((int)pixels[i + c] - (int)other.pixels[i + c]);
+				worst = glm::max(worst, difference);
+				squaredError += (double)(difference * difference);
+			}
+			if (worst > tolerance)
+				mismatched++;
+		}
+		if (rmse != nullptr)
+			*rmse = pixels.empty() ? 0.00f : (float)sqrt(squaredError / (double)pixels.size());
+		return pixels.empty() ? 0.00f : (float)mismatched / (float)(pixels.size() / 3);
 	}
 
-	unsigned int const GetSize()
+	int GetWidth()
 	{
-		return size;
+		return width;
+	}
+
+	int GetHeight()
+	{
+		return height;
 	}
 };
 
-class GLObject
+constexpr unsigned int noResource = 0xFFFFFFFF;
+
+//a texture passes read from or draw into, either owned by the graph (transient) or owned elsewhere (imported)
+struct RenderResource
 {
-protected:
-	GLBuffer* attribBuffer;
-	GLBuffer* indexBuffer;
-	unsigned int indexCount = 0;
-	unsigned int triCount = 0;
-	glm::uint object = 0;
+	const char* name;
+	bool imported = false;
+	bool isBackbuffer = false;
+	Texture* texture = nullptr; //physical texture, transient ones get theirs when the graph is compiled
+	int width = 0;
+	int height = 0;
+	GLenum internalFormat = GL_RGBA;
+	GLenum format = GL_RGBA;
+	GLenum type = GL_UNSIGNED_BYTE;
+	bool isDepth = false;
+	bool clear = false; //cleared by the first pass that writes it each frame
+	glm::vec4 clearValue = glm::vec4(0.00f);
+	int firstUse = -1; //first and last live pass that touches us, used to alias transient textures
+	int lastUse = -1;
+};
 
+class RenderPass
+{
 public:
-	GLObject(void* attribData, unsigned int size, int attribOffset = 0)
+	const char* name;
+	std::function<void()> execute;
+	std::vector<unsigned int> inputs; //resources sampled by the pass
+	std::vector<int> inputUnits; //texture unit each input is bound to
+	std::vector<unsigned int> colorOutputs;
+	unsigned int depthOutput = noResource;
+	bool depthTest = true;
+	bool depthWrite = true;
+	GLenum depthFunc = GL_LESS;
+	GLenum cullFace = GL_BACK;
+	bool external = false; //binds its own framebuffer and viewport, outputs are still declared so dependencies work
+	bool sideEffect = false; //never culled even if nothing reads our outputs
+	bool scaled = false; //draws at the graph's render scale into the bottom left of its targets
+	bool culled = false;
+	bool toBackbuffer = false; //draws into whatever framebuffer stands in for the window
+	std::vector<unsigned int> clears; //resources this pass clears because it writes them first
+	unsigned int framebuffer = 0;
+	unsigned int queries[2] = { 0, 0 }; //double buffered so reading the timings never stalls
+	bool queryPending[2] = { false, false };
+	double gpuTime = 0.00; //milliseconds
+	double cpuTime = 0.00; //..
+	RenderStats stats; //what the pass submitted last time it ran
+
+	RenderPass(const char* _name, std::function<void()> _execute)
 	{
-		attribBuffer = new GLBuffer(attribData, size); //create vertex attribute buffer
-		indexBuffer = nullptr; //no index buffer
-		triCount = size / sizeof(Vertex); //number of tris in buffer (5 floats per tri)
-		indexCount = 0; //not using indexed rendering so doesn't matter
-		glGenVertexArrays(1, &object); //generate the VAO
-		glBindVertexArray(object); //bind it
-		glBindBuffer(GL_ARRAY_BUFFER, attribBuffer->GetBuffer()); //bind the attrib buff to the VAO
-		SetupAttributes(attribOffset); //setup the vertex attributes
-		glBindVertexArray(0); //unbind for safety
+		name = _name;
+		execute = _execute;
 	}
 
-	GLObject(void* attribData, unsigned int attribSize, void* indexData, unsigned int indexSize, int attribOffset = 0)
+	void Read(unsigned int resource, int unit)
 	{
-		attribBuffer = new GLBuffer(attribData, attribSize); //create vertex attribute buffer
-		indexBuffer = new GLBuffer(indexData, indexSize); //create vertex index buffer
-		triCount = attribSize / sizeof(Vertex);
-		indexCount = indexSize / sizeof(unsigned int);
-		glGenVertexArrays(1, &object); //..
-		glBindVertexArray(object); //..
-		glBindBuffer(GL_ARRAY_BUFFER, attribBuffer->GetBuffer()); //..
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->GetBuffer()); //bind the index buff to VAO
-		SetupAttributes(attribOffset); //..
-		glBindVertexArray(0); //..
+		inputs.push_back(resource);
+		inputUnits.push_back(unit);
 	}
 
-	GLObject(const GLObject& other)
+	void Write(unsigned int resource)
 	{
-		attribBuffer = new GLBuffer(*other.attribBuffer); //create vertex attribute buffer
-		triCount = other.triCount;
-		indexCount = 0;
-		if (other.indexBuffer != nullptr)
-		{
-			indexBuffer = new GLBuffer(*other.indexBuffer); //create vertex index buffer
-			indexCount = other.indexCount;
+		colorOutputs.push_back(resource);
+	}
+
+	//attach a depth target, set write to false to only test against it
+	void Depth(unsigned int resource, bool write = true, GLenum func = GL_LESS)
+	{
+		depthOutput = resource;
+		depthWrite = write;
+		depthFunc = func;
+	}
+
+	bool Writes(unsigned int resource)
+	{
+		return depthOutput == resource || std::find(colorOutputs.begin(), colorOutputs.end(), resource) != colorOutputs.end();
+	}
+
+	bool Reads(unsigned int resource)
+	{
+		return (depthOutput == resource && !depthWrite) || std::find(inputs.begin(), inputs.end(), resource) != inputs.end();
+	}
+};
+
+//runs passes in the order they were added, binding their targets and state
+//passes whose outputs nothing reads are culled, only the first writer of a target clears it
+//and transient targets whose lifetimes don't overlap share a texture
+class RenderGraph
+{
+protected:
+	std::vector<RenderResource> resources;
+	std::vector<RenderPass*> passes;
+	std::vector<Texture*> pool; //physical transient textures
+	unsigned long long frame = 0;
+	float renderScale = 1.00f; //fraction of the screen resolution the scaled passes draw at
+	unsigned int backbufferFramebuffer = 0; //the window's default framebuffer unless rendering offscreen
+	RenderStats frameStart; //renderStats at the end of the previous Execute
+	RenderStats frameStats; //everything submitted between the end of the previous Execute and the end of the last one
+
+	void CullPasses()
+	{
+		std::vector<bool> needed = std::vector<bool>(resources.size(), false);
+		for (long long int i = (long long int)passes.size() - 1; i >= 0; i--) //walk backwards from the sinks
+		{
+			RenderPass* pass = passes[i];
+			if (!pass->external && pass->colorOutputs.empty() && pass->depthOutput == noResource) //nothing to bind or size the viewport from
+			{
+				std::cout << "Error: Render pass " << pass->name << " has no outputs, it won't run!\n";
+				pass->culled = true;
+				continue;
+			}
+			bool live = pass->sideEffect;
+			for (unsigned int r = 0; r < resources.size(); r++)
+			{
+				if (pass->Writes(r) && (needed[r] || resources[r].isBackbuffer))
+					live = true;
+			}
+			pass->culled = !live;
+			if (!live)
+				continue;
+			for (unsigned int r = 0; r < resources.size(); r++)
+			{
+				if (pass->Reads(r) || pass->Writes(r)) //partial writes need whatever was drawn before them
+					needed[r] = true;
+			}
+		}
+	}
+
+	void AssignTextures()
+	{
+		for (unsigned int r = 0; r < resources.size(); r++)
+		{
+			resources[r].firstUse = -1;
+			resources[r].lastUse = -1;
+			if (!resources[r].imported)
+				resources[r].texture = nullptr;
+		}
+		for (unsigned int p = 0; p < passes.size(); p++) //find each resource's lifetime over the live passes
+		{
+			passes[p]->clears.clear();
+			if (passes[p]->culled)
+				continue;
+			for (unsigned int r = 0; r < resources.size(); r++)
+			{
+				if (!passes[p]->Reads(r) && !passes[p]->Writes(r))
+					continue;
+				if (resources[r].firstUse < 0)
+				{
+					resources[r].firstUse = p;
+					if (resources[r].clear && passes[p]->Writes(r) && !passes[p]->external) //the first writer clears, later clears would be redundant
+						passes[p]->clears.push_back(r);
+				}
+				resources[r].lastUse = p;
+			}
+		}
+		std::vector<int> poolOwner = std::vector<int>(pool.size(), -1); //resource currently living in each pooled texture
+		for (unsigned int p = 0; p < passes.size(); p++)
+		{
+			for (unsigned int r = 0; r < resources.size(); r++) //give textures to resources that start here
+			{
+				RenderResource& resource = resources[r];
+				if (resource.imported || resource.firstUse != (int)p)
+					continue;
+				for (unsigned int t = 0; t < pool.size() && resource.texture == nullptr; t++)
+				{
+					if (poolOwner[t] < 0 && pool[t]->GetWidth() == resource.width && pool[t]->GetHeight() == resource.height && pool[t]->GetFormat() == resource.internalFormat)
+					{
+						resource.texture = pool[t]; //alias a texture nobody is using anymore
+						poolOwner[t] = r;
+					}
+				}
+				if (resource.texture == nullptr)
+				{
+					resource.texture = new Texture(resource.width, resource.height, resource.internalFormat, resource.format, resource.type);
+					pool.push_back(resource.texture);
+					poolOwner.push_back(r);
+				}
+			}
+			for (unsigned int t = 0; t < pool.size(); t++) //free textures whose resource ends here
+			{
+				if (poolOwner[t] >= 0 && resources[poolOwner[t]].lastUse == (int)p)
+					poolOwner[t] = -1;
+			}
+		}
+	}
+
+	void CreateFramebuffers()
+	{
+		for (unsigned int p = 0; p < passes.size(); p++)
+		{
+			RenderPass* pass = passes[p];
+			if (pass->framebuffer != 0)
+				glDeleteFramebuffers(1, &pass->framebuffer);
+			pass->framebuffer = 0;
+			pass->toBackbuffer = false;
+			if (pass->culled || pass->external)
+				continue;
+			for (unsigned int i = 0; i < pass->colorOutputs.size(); i++)
+				pass->toBackbuffer |= resources[pass->colorOutputs[i]].isBackbuffer;
+			if (pass->toBackbuffer) //bound from backbufferFramebuffer when executed
+				continue;
+			glCreateFramebuffers(1, &pass->framebuffer);
+			std::vector<GLenum> drawBuffers;
+			for (unsigned int i = 0; i < pass->colorOutputs.size(); i++)
+			{
+				glNamedFramebufferTexture(pass->framebuffer, GL_COLOR_ATTACHMENT0 + i, resources[pass->colorOutputs[i]].texture->GetTexture(), 0);
+				drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+			}
+			if (drawBuffers.empty())
+				glNamedFramebufferDrawBuffer(pass->framebuffer, GL_NONE);
+			else
+				glNamedFramebufferDrawBuffers(pass->framebuffer, (int)drawBuffers.size(), drawBuffers.data());
+			if (pass->depthOutput != noResource)
+				glNamedFramebufferTexture(pass->framebuffer, GL_DEPTH_ATTACHMENT, resources[pass->depthOutput].texture->GetTexture(), 0);
+			int completeness = glCheckNamedFramebufferStatus(pass->framebuffer, GL_FRAMEBUFFER);
+			if (completeness != GL_FRAMEBUFFER_COMPLETE) //check if framebuffer is complete
+			{
+				std::cout << "Error: Render pass " << pass->name << " framebuffer incomplete: 0x" << std::hex << completeness << std::dec << "\n";
+			}
+		}
+	}
+
+	void ReadTimings(RenderPass* pass, int slot)
+	{
+		if (!pass->queryPending[slot])
+			return;
+		int available = 0;
+		glGetQueryObjectiv(pass->queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) //keep the old value rather than stall
+			return;
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(pass->queries[slot], GL_QUERY_RESULT, &elapsed);
+		pass->gpuTime = (double)elapsed / 1000000.00;
+		pass->queryPending[slot] = false;
+	}
+
+public:
+	~RenderGraph()
+	{
+		for (unsigned int p = 0; p < passes.size(); p++)
+		{
+			if (passes[p]->framebuffer != 0)
+				glDeleteFramebuffers(1, &passes[p]->framebuffer);
+			glDeleteQueries(2, passes[p]->queries);
+			delete passes[p];
+		}
+		for (unsigned int t = 0; t < pool.size(); t++)
+			delete pool[t];
+	}
+
+	//a graph owned target, only allocated if a live pass uses it
+	unsigned int CreateTarget(const char* name, int width, int height, GLenum internalFormat, GLenum format, GLenum type, bool clear, glm::vec4 clearValue = glm::vec4(0.00f))
+	{
+		RenderResource resource;
+		resource.name = name;
+		resource.width = width;
+		resource.height = height;
+		resource.internalFormat = internalFormat;
+		resource.format = format;
+		resource.type = type;
+		resource.isDepth = format == GL_DEPTH_COMPONENT;
+		resource.clear = clear;
+		resource.clearValue = clearValue;
+		resources.push_back(resource);
+		return (unsigned int)resources.size() - 1;
+	}
+
+	//a texture owned elsewhere, e.g. the sun's shadow maps
+	unsigned int ImportTexture(const char* name, Texture* texture)
+	{
+		RenderResource resource;
+		resource.name = name;
+		resource.imported = true;
+		resource.texture = texture;
+		resources.push_back(resource);
+		return (unsigned int)resources.size() - 1;
+	}
+
+	//the window, passes writing here are the roots that keep everything else alive
+	unsigned int ImportBackbuffer(const char* name, bool clearDepth)
+	{
+		RenderResource resource;
+		resource.name = name;
+		resource.imported = true;
+		resource.isBackbuffer = true;
+		resource.width = (int)screenWidth;
+		resource.height = (int)screenHeight;
+		resource.isDepth = clearDepth; //the back buffer only ever needs its depth cleared
+		resource.clear = clearDepth;
+		resource.clearValue = glm::vec4(1.00f);
+		resources.push_back(resource);
+		return (unsigned int)resources.size() - 1;
+	}
+
+	RenderPass* AddPass(const char* name, std::function<void()> execute)
+	{
+		RenderPass* pass = new RenderPass(name, execute);
+		glCreateQueries(GL_TIME_ELAPSED, 2, pass->queries);
+		passes.push_back(pass);
+		return pass;
+	}
+
+	//call after adding or changing passes
+	void Compile()
+	{
+		CullPasses();
+		AssignTextures();
+		CreateFramebuffers();
+	}
+
+	void Execute()
+	{
+		int slot = (int)(frame % 2);
+		for (unsigned int p = 0; p < passes.size(); p++)
+		{
+			RenderPass* pass = passes[p];
+			if (pass->culled)
+				continue;
+			ReadTimings(pass, slot); //results from two frames ago
+			unsigned long long cpuStart = SDL_GetPerformanceCounter();
+			RenderStats passStart = renderStats;
+			glBeginQuery(GL_TIME_ELAPSED, pass->queries[slot]);
+			for (unsigned int i = 0; i < pass->inputs.size(); i++)
+				resources[pass->inputs[i]].texture->Use(pass->inputUnits[i]);
+			if (!pass->external)
+			{
+				unsigned int framebuffer = pass->toBackbuffer ? backbufferFramebuffer : pass->framebuffer;
+				glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+				RenderResource& target = pass->colorOutputs.empty() ? resources[pass->depthOutput] : resources[pass->colorOutputs[0]];
+				int width = target.isBackbuffer ? target.width : target.texture->GetWidth();
+				int height = target.isBackbuffer ? target.height : target.texture->GetHeight();
+				if (pass->scaled) //the targets are allocated at the max scale so resizing never reallocates
+				{
+					width = GetRenderWidth();
+					height = GetRenderHeight();
+				}
+				glViewport(0, 0, width, height);
+				glDepthMask(GL_TRUE); //clears respect the depth mask
+				for (unsigned int i = 0; i < pass->clears.size(); i++)
+				{
+					RenderResource& resource = resources[pass->clears[i]];
+					if (resource.isDepth)
+						glClearNamedFramebufferfv(framebuffer, GL_DEPTH, 0, &resource.clearValue.x);
+					else
+					{
+						int attachment = (int)(std::find(pass->colorOutputs.begin(), pass->colorOutputs.end(), pass->clears[i]) - pass->colorOutputs.begin());
+						glClearNamedFramebufferfv(framebuffer, GL_COLOR, attachment, glm::value_ptr(resource.clearValue));
+					}
+				}
+			}
+			if (pass->depthTest) //external passes still get their depth and cull state set
+				glEnable(GL_DEPTH_TEST);
+			else
+				glDisable(GL_DEPTH_TEST);
+			glDepthMask(pass->depthWrite ? GL_TRUE : GL_FALSE);
+			glDepthFunc(pass->depthFunc);
+			glCullFace(pass->cullFace);
+			pass->execute();
+			glEndQuery(GL_TIME_ELAPSED);
+			pass->queryPending[slot] = true;
+			pass->cpuTime = (double)(SDL_GetPerformanceCounter() - cpuStart) * 1000.00 / (double)SDL_GetPerformanceFrequency();
+			pass->stats = renderStats.Since(passStart);
+		}
+		glEnable(GL_DEPTH_TEST); //leave the default state for anything drawn outside the graph
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LESS);
+		glCullFace(GL_BACK);
+		frameStats = renderStats.Since(frameStart); //includes the updates and uploads done between graph runs
+		frameStart = renderStats;
+		frame++;
+	}
+
+	Texture* GetTexture(unsigned int resource)
+	{
+		return resources[resource].texture;
+	}
+
+	std::vector<RenderPass*>& GetPasses()
+	{
+		return passes;
+	}
+
+	RenderStats& GetFrameStats()
+	{
+		return frameStats;
+	}
+
+	//total GPU time of the live passes that are (or aren't) scaled
+	double GetGpuTime(bool scaled)
+	{
+		double total = 0.00;
+		for (unsigned int p = 0; p < passes.size(); p++)
+		{
+			if (!passes[p]->culled && passes[p]->scaled == scaled)
+				total += passes[p]->gpuTime;
+		}
+		return total;
+	}
+
+	void SetRenderScale(float scale)
+	{
+		renderScale = scale;
+	}
+
+	float GetRenderScale()
+	{
+		return renderScale;
+	}
+
+	//redirect the backbuffer passes, e.g. into an offscreen target when there is no window to present to
+	//it must be the screen size and have a depth attachment, 0 is the window
+	void SetBackbufferFramebuffer(unsigned int framebuffer)
+	{
+		backbufferFramebuffer = framebuffer;
+	}
+
+	unsigned int GetBackbufferFramebuffer()
+	{
+		return backbufferFramebuffer;
+	}
+
+	int GetRenderWidth()
+	{
+		return glm::max((int)(screenWidth * renderScale), 1);
+	}
+
+	int GetRenderHeight()
+	{
+		return glm::max((int)(screenHeight * renderScale), 1);
+	}
+};
+
+//picks the render scale each frame so the GPU time stays near a target
+//the scaled passes cost roughly their pixel count, so the scale moves by the square root of how far over or under budget they are
+class DynamicResolution
+{
+protected:
+	float targetTime; //milliseconds of GPU time per frame
+	float minScale;
+	float maxScale;
+	float scaleLimit; //the constructor's maxScale, the scene targets are allocated at it so the range can never go above it
+	float scale;
+	float maxStep = 0.05f; //the timings are two frames old so big jumps would oscillate
+	float headroom = 0.90f; //only scale up when comfortably under the target
+	double scaledTime = 0.00; //smoothed
+	double fixedTime = 0.00; //..
+	bool hasTimings = false;
+
+public:
+	DynamicResolution(float _targetTime, float _minScale = 0.50f, float _maxScale = 1.00f)
+	{
+		targetTime = _targetTime;
+		minScale = _minScale;
+		maxScale = _maxScale;
+		scaleLimit = maxScale;
+		scale = maxScale;
+	}
+
+	//feed in the last GPU timings of the scaled and unscaled passes and get the scale to draw the next frame at
+	float Update(double newScaledTime, double newFixedTime)
+	{
+		if (newScaledTime <= 0.00) //no timings yet
+			return scale;
+		if (!hasTimings)
+		{
+			scaledTime = newScaledTime;
+			fixedTime = newFixedTime;
+			hasTimings = true;
+		}
+		scaledTime = glm::mix(scaledTime, newScaledTime, 0.10);
+		fixedTime = glm::mix(fixedTime, newFixedTime, 0.10);
+		double budget = glm::max((double)targetTime - fixedTime, 0.00); //what is left for the scaled passes
+		float ideal = scale * (float)glm::sqrt(budget / scaledTime);
+		if (ideal > scale && scaledTime + fixedTime > targetTime * headroom) //close enough, don't creep up and straight back down
+			return scale;
+		scale = glm::clamp(glm::clamp(ideal, scale - maxStep, scale + maxStep), minScale, maxScale);
+		return scale;
+	}
+
+	float GetScale()
+	{
+		return scale;
+	}
+
+	float GetMinScale()
+	{
+		return minScale;
+	}
+
+	float GetMaxScale()
+	{
+		return maxScale;
+	}
+
+	float GetTargetTime()
+	{
+		return targetTime;
+	}
+
+	void SetTargetTime(float time)
+	{
+		targetTime = time;
+	}
+
+	//maxScale is clamped to the one we were made with, bigger would draw past the edge of the scene targets
+	void SetScaleRange(float _minScale, float _maxScale)
+	{
+		maxScale = glm::min(_maxScale, scaleLimit);
+		minScale = glm::min(_minScale, maxScale);
+		scale = glm::clamp(scale, minScale, maxScale);
+	}
+};
+
+class GLBuffer
+{
+protected:
+	glm::uint buffer = 0;
+	unsigned int size = 0;
+
+public:
+	GLBuffer(void* data, unsigned int _size)
+	{
+		glCreateBuffers(1, &buffer); //generate and initalize buffer
+		glNamedBufferData(buffer, _size, data, GL_STATIC_DRAW); //populate it
+		size = _size;
+	}
+
+	GLBuffer(const GLBuffer& other)
+	{
+		unsigned int _size = other.size;
+		glCreateBuffers(1, &buffer); //generate and initalize our buffer
+		glNamedBufferData(buffer, _size, (void*)0, GL_STATIC_DRAW); //populate our buffer with empty data
+		glCopyNamedBufferSubData(other.buffer, buffer, 0, 0, _size); //copy other.buffer into buffer
+		size = _size;
+	}
+
+	GLBuffer()
+	{
+		buffer = 0;
+		size = 0;
+	}
+
+	~GLBuffer()
+	{
+		glDeleteBuffers(1, &buffer);
+	}
+
+	glm::uint const GetBuffer()
+	{
+		return buffer;
+	}
+
+	unsigned int const GetSize()
+	{
+		return size;
+	}
+};
+
+//where a StreamBuffer allocation lives, data is nullptr if the frame's region ran out of space
+struct StreamAllocation
+{
+	void* data = nullptr; //write here with memcpy, visible to the GPU without flushing
+	unsigned int offset = 0; //from the start of the buffer, for binding
+	unsigned int size = 0;
+};
+
+//one persistently mapped buffer split into a region per frame in flight, for data that is rewritten every frame
+//a region is fenced when its frame ends and only handed out again once the GPU has finished reading it
+class StreamBuffer
+{
+public:
+	static constexpr int maxFramesInFlight = 4;
+
+protected:
+	glm::uint buffer = 0;
+	unsigned char* mapped = nullptr;
+	unsigned int regionSize;
+	int numRegions;
+	int region = 0; //the current frame's region
+	unsigned int head = 0; //next free byte in the region
+	unsigned int alignment; //the strictest offset alignment of the buffer targets we get bound to
+	GLsync fences[maxFramesInFlight];
+	bool overflowed = false;
+
+public:
+	StreamBuffer(unsigned int _regionSize, int framesInFlight = 3)
+	{
+		int uniformAlignment = 0;
+		int storageAlignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+		alignment = (unsigned int)glm::max(glm::max(uniformAlignment, storageAlignment), 16); //16 keeps vec4s aligned for instance data too
+		numRegions = glm::clamp(framesInFlight, 1, maxFramesInFlight);
+		regionSize = ((_regionSize + alignment - 1) / alignment) * alignment;
+		for (int i = 0; i < maxFramesInFlight; i++)
+			fences[i] = nullptr;
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, regionSize * numRegions, nullptr, flags);
+		mapped = static_cast<unsigned char*>(glMapNamedBufferRange(buffer, 0, regionSize * numRegions, flags)); //stays mapped for the buffer's whole life
+		if (mapped == nullptr)
+			std::cout << "Error: Failed to map the stream buffer!\n";
+	}
+
+	~StreamBuffer()
+	{
+		for (int i = 0; i < maxFramesInFlight; i++)
+		{
+			if (fences[i] != nullptr)
+				glDeleteSync(fences[i]);
+		}
+		glUnmapNamedBuffer(buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+
+	//call before the first allocation of a frame, only blocks if the GPU is more than framesInFlight frames behind
+	void BeginFrame()
+	{
+		if (fences[region] != nullptr)
+		{
+			GLenum status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			while (status == GL_TIMEOUT_EXPIRED)
+				status = glClientWaitSync(fences[region], 0, 1000000); //1ms at a time
+			if (status == GL_WAIT_FAILED)
+				std::cout << "Error: Waiting on the stream buffer fence failed!\n";
+			glDeleteSync(fences[region]);
+			fences[region] = nullptr;
+		}
+		head = 0;
+		overflowed = false;
+	}
+
+	//call once everything reading this frame's allocations has been submitted
+	void EndFrame()
+	{
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		region = (region + 1) % numRegions;
+	}
+
+	//space for this frame only, the offset is aligned so it can be bound as a uniform or storage range
+	StreamAllocation Allocate(unsigned int size)
+	{
+		StreamAllocation allocation;
+		unsigned int offset = ((head + alignment - 1) / alignment) * alignment;
+		if (mapped == nullptr || offset + size > regionSize)
+		{
+			if (!overflowed) //once per frame is enough
+				std::cout << "Warning: Stream buffer region full, " << size << " bytes dropped!\n";
+			overflowed = true;
+			return allocation;
+		}
+		head = offset + size;
+#ifdef RENDER_STATS
+		renderStats.bufferBytes += size; //written straight into mapped memory so no GL call sees it
+#endif
+		allocation.offset = region * regionSize + offset;
+		allocation.data = mapped + allocation.offset;
+		allocation.size = size;
+		return allocation;
+	}
+
+	//allocate and copy in one go
+	StreamAllocation Write(const void* data, unsigned int size)
+	{
+		StreamAllocation allocation = Allocate(size);
+		if (allocation.data != nullptr)
+			memcpy(allocation.data, data, size);
+		return allocation;
+	}
+
+	//target is GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER
+	void BindRange(GLenum target, unsigned int index, StreamAllocation& allocation)
+	{
+		glBindBufferRange(target, index, buffer, allocation.offset, allocation.size);
+	}
+
+	glm::uint GetBuffer()
+	{
+		return buffer;
+	}
+
+	unsigned int GetRegionSize()
+	{
+		return regionSize;
+	}
+
+	unsigned int GetUsed()
+	{
+		return head;
+	}
+};
+
+StreamBuffer* frameStream = nullptr; //per frame dynamic data, every allocation is only valid until the next BeginFrame
+
+//a light for the deferred path, laid out like the Light struct in outline.frag under std430
+struct PointLight
+{
+	glm::vec3 position;
+	float padding0;
+	glm::vec3 color;
+	float constant;
+	float linear;
+	float quadratic;
+	float radius; //where the attenuated light drops below the cutoff, nothing outside it is shaded
+	float padding1;
+};
+
+//cutoff is the faintest light (0-1) worth shading, it sets how big the light volume is
+PointLight MakePointLight(glm::vec3 position, glm::vec3 color, float constant, float linear, float quadratic, float cutoff = 1.00f / 256.00f)
+{
+	PointLight light;
+	light.position = position;
+	light.padding0 = 0.00f;
+	light.color = color;
+	light.constant = constant;
+	light.linear = linear;
+	light.quadratic = quadratic;
+	light.padding1 = 0.00f;
+	float brightest = glm::max(color.r, glm::max(color.g, color.b));
+	float c = constant - brightest / cutoff; //solve brightest / (constant + linear * d + quadratic * d^2) = cutoff for d
+	if (quadratic > 0.00f)
+		light.radius = (-linear + glm::sqrt(linear * linear - 4.00f * quadratic * c)) / (2.00f * quadratic);
+	else if (linear > 0.00f)
+		light.radius = -c / linear;
+	else
+		light.radius = 1000.00f; //never falls off
+	light.radius = glm::max(light.radius, 0.00f);
+	return light;
+}
+
+std::vector<PointLight> pointLights; //gathered every frame for the deferred lighting pass
+
+//one light volume per point light, additively blended, shader must be the POINT_LIGHT variant and already active
+void DrawPointLights()
+{
+	if (pointLights.empty())
+		return;
+	StreamAllocation allocation = frameStream->Write(pointLights.data(), (unsigned int)(pointLights.size() * sizeof(PointLight)));
+	if (allocation.data == nullptr)
+		return;
+	frameStream->BindRange(GL_SHADER_STORAGE_BUFFER, 3, allocation);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	DrawInstancedQuads((unsigned int)pointLights.size());
+	glDisable(GL_BLEND);
+}
+
+//lines of text in the top left corner of the screen, the font is built into stats_overlay.frag
+//it only has upper case, digits and symbols so lower case is drawn as upper case
+class TextOverlay
+{
+protected:
+	Shader* shader;
+	int columns;
+	int rows;
+	int scale; //screen pixels per font pixel
+	std::vector<std::string> lines;
+
+public:
+	TextOverlay(Shader* _shader, int _columns, int _rows, int _scale = 2)
+	{
+		shader = _shader;
+		columns = _columns;
+		rows = _rows;
+		scale = _scale;
+	}
+
+	void Clear()
+	{
+		lines.clear();
+	}
+
+	//lines past the last row are dropped, long lines are cut at the last column
+	void AddLine(std::string line)
+	{
+		if ((int)lines.size() < rows)
+			lines.push_back(line);
+	}
+
+	//blended over whatever is bound, the characters go through frameStream
+	void Draw()
+	{
+		if (lines.empty())
+			return;
+		int usedRows = (int)lines.size();
+		std::vector<unsigned int> text = std::vector<unsigned int>((columns * usedRows + 3) / 4, 0);
+		for (int y = 0; y < usedRows; y++)
+		{
+			for (int x = 0; x < columns && x < (int)lines[y].size(); x++)
+			{
+				int index = y * columns + x;
+				text[index / 4] |= (unsigned int)(unsigned char)toupper(lines[y][x]) << ((index % 4) * 8);
+			}
+		}
+		StreamAllocation allocation = frameStream->Write(text.data(), (unsigned int)(text.size() * sizeof(unsigned int)));
+		if (allocation.data == nullptr)
+			return;
+		frameStream->BindRange(GL_SHADER_STORAGE_BUFFER, 4, allocation);
+		shader->Use();
+		glUniform2i(glGetUniformLocation(shader->GetProgram(), "gridSize"), columns, usedRows);
+		glUniform1i(glGetUniformLocation(shader->GetProgram(), "scale"), scale);
+		glUniform2i(glGetUniformLocation(shader->GetProgram(), "screenSize"), (int)screenWidth, (int)screenHeight);
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		DrawInstancedQuads(1);
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+	}
+};
+
+struct ArenaBlock
+{
+	unsigned int offset;
+	unsigned int size;
+};
+
+//first fit free list allocator over a fixed range of bytes, it only tracks offsets so it can manage GPU memory
+class ArenaAllocator
+{
+protected:
+	std::vector<ArenaBlock> freeBlocks; //sorted by offset, neighbouring blocks are always merged
+	unsigned int capacity = 0;
+	unsigned int used = 0;
+
+public:
+	ArenaAllocator()
+	{
+	}
+
+	ArenaAllocator(unsigned int _capacity)
+	{
+		capacity = _capacity;
+		freeBlocks.push_back(ArenaBlock{ 0, capacity });
+	}
+
+	//returns false if there is no free block big enough
+	bool Allocate(unsigned int size, unsigned int alignment, unsigned int& offset)
+	{
+		for (unsigned long long int i = 0; i < freeBlocks.size(); i++) //loop over each free block
+		{
+			ArenaBlock block = freeBlocks[i];
+			unsigned int alignedOffset = ((block.offset + alignment - 1) / alignment) * alignment; //round the start up to the alignment
+			unsigned int padding = alignedOffset - block.offset;
+			if (block.size < size + padding) //if it doesn't fit
+				continue;
+			freeBlocks.erase(freeBlocks.begin() + i);
+			if (block.size - padding - size > 0) //put the tail back
+				freeBlocks.insert(freeBlocks.begin() + i, ArenaBlock{ alignedOffset + size, block.size - padding - size });
+			if (padding > 0) //put the alignment padding back
+				freeBlocks.insert(freeBlocks.begin() + i, ArenaBlock{ block.offset, padding });
+			offset = alignedOffset;
+			used += size;
+			return true;
+		}
+		return false;
+	}
+
+	void Free(unsigned int offset, unsigned int size)
+	{
+		unsigned long long int i = 0;
+		while (i < freeBlocks.size() && freeBlocks[i].offset < offset) //find where the block goes
+			i++;
+		freeBlocks.insert(freeBlocks.begin() + i, ArenaBlock{ offset, size });
+		used -= size;
+		if (i + 1 < freeBlocks.size() && freeBlocks[i].offset + freeBlocks[i].size == freeBlocks[i + 1].offset) //merge with the next block
+		{
+			freeBlocks[i].size += freeBlocks[i + 1].size;
+			freeBlocks.erase(freeBlocks.begin() + i + 1);
+		}
+		if (i > 0 && freeBlocks[i - 1].offset + freeBlocks[i - 1].size == freeBlocks[i].offset) //merge with the previous block
+		{
+			freeBlocks[i - 1].size += freeBlocks[i].size;
+			freeBlocks.erase(freeBlocks.begin() + i);
+		}
+	}
+
+	unsigned int GetUsed()
+	{
+		return used;
+	}
+
+	unsigned int GetCapacity()
+	{
+		return capacity;
+	}
+};
+
+//where a mesh lives inside the GeometryArena
+struct GeometryRange
+{
+	unsigned int vertexOffset = 0; //in bytes
+	unsigned int vertexSize = 0; //..
+	unsigned int indexOffset = 0; //..
+	unsigned int indexSize = 0; //..
+	int baseVertex = 0; //added to every index when drawing
+	unsigned int firstIndex = 0;
+};
+
+//how a mesh's vertices are laid out on the GPU, chosen per mesh at import
+enum class VertexFormat
+{
+	standard, //Vertex: float position + float normal + float uv (32 bytes)
+	packed, //float position + 2_10_10_10 normal (16 bytes)
+	packedHalf, //half position + 2_10_10_10 normal (12 bytes), only for small meshes as halfs lose precision quickly
+	packedUV, //float position + 2_10_10_10 normal + half uv (20 bytes)
+	count
+};
+
+struct VertexLayout
+{
+	unsigned int stride;
+	GLenum positionType;
+	unsigned int normalOffset;
+	GLenum normalType;
+	int normalCount;
+	GLboolean normalNormalized;
+	bool hasUV = false;
+	unsigned int uvOffset = 0;
+	GLenum uvType = GL_FLOAT;
+};
+
+VertexLayout GetVertexLayout(VertexFormat format)
+{
+	switch (format)
+	{
+	case VertexFormat::packed:
+		return VertexLayout{ 16, GL_FLOAT, 12, GL_INT_2_10_10_10_REV, 4, GL_TRUE };
+	case VertexFormat::packedHalf:
+		return VertexLayout{ 12, GL_HALF_FLOAT, 8, GL_INT_2_10_10_10_REV, 4, GL_TRUE }; //position is padded to 4 halfs
+	case VertexFormat::packedUV:
+		return VertexLayout{ 20, GL_FLOAT, 12, GL_INT_2_10_10_10_REV, 4, GL_TRUE, true, 16, GL_HALF_FLOAT };
+	default:
+		return VertexLayout{ sizeof(Vertex), GL_FLOAT, offsetof(Vertex, normal), GL_FLOAT, 3, GL_FALSE, true, offsetof(Vertex, uv), GL_FLOAT };
+	}
+}
+
+//the smallest index type that can address vertexCount vertices
+GLenum GetIndexType(unsigned int vertexCount)
+{
+	if (vertexCount <= 65536) //if every index fits in 16 bits
+		return GL_UNSIGNED_SHORT;
+	return GL_UNSIGNED_INT;
+}
+
+unsigned int GetIndexSize(GLenum indexType)
+{
+	if (indexType == GL_UNSIGNED_SHORT)
+		return sizeof(unsigned short);
+	return sizeof(unsigned int);
+}
+
+//one immutable vertex buffer and one immutable index buffer that every mesh is suballocated from
+//meshes share one VAO per vertex format so drawing them needs no VAO switches
+class GeometryArena
+{
+protected:
+	glm::uint vertexBuffer = 0;
+	glm::uint indexBuffer = 0;
+	ArenaAllocator vertexSpace;
+	ArenaAllocator indexSpace;
+	glm::uint vertexArrays[(int)VertexFormat::count];
+	glm::uint morphArrays[(int)VertexFormat::count]; //attribs 0 and 1 from binding 0, 2 and 3 (the frame to blend to) from binding 1
+
+public:
+	GeometryArena(unsigned int vertexCapacity, unsigned int indexCapacity)
+	{
+		vertexSpace = ArenaAllocator(vertexCapacity);
+		indexSpace = ArenaAllocator(indexCapacity);
+		glCreateBuffers(1, &vertexBuffer);
+		glNamedBufferStorage(vertexBuffer, vertexCapacity, nullptr, GL_DYNAMIC_STORAGE_BIT); //immutable size, contents are filled with glNamedBufferSubData
+		glCreateBuffers(1, &indexBuffer);
+		glNamedBufferStorage(indexBuffer, indexCapacity, nullptr, GL_DYNAMIC_STORAGE_BIT); //..
+
+		for (int i = 0; i < (int)VertexFormat::count; i++) //one VAO per format, all reading from the same buffers
+		{
+			VertexLayout layout = GetVertexLayout((VertexFormat)i);
+			glm::uint vao = 0;
+			glCreateVertexArrays(1, &vao);
+			glVertexArrayVertexBuffer(vao, 0, vertexBuffer, 0, layout.stride); //binding point, buffer, offset, stride
+			glVertexArrayElementBuffer(vao, indexBuffer);
+			glVertexArrayAttribFormat(vao, 0, 3, layout.positionType, GL_FALSE, 0); //attrib, count, type, normalize?, relative offset
+			glVertexArrayAttribBinding(vao, 0, 0); //read attrib 0 from binding point 0
+			glEnableVertexArrayAttrib(vao, 0);
+			glVertexArrayAttribFormat(vao, 1, layout.normalCount, layout.normalType, layout.normalNormalized, layout.normalOffset);
+			glVertexArrayAttribBinding(vao, 1, 0);
+			glEnableVertexArrayAttrib(vao, 1);
+			if (layout.hasUV && (VertexFormat)i != VertexFormat::standard) //standard never bound its uvs, keep it that way
+			{
+				glVertexArrayAttribFormat(vao, 4, 2, layout.uvType, GL_FALSE, layout.uvOffset); //after the next frame attributes of the animated shaders
+				glVertexArrayAttribBinding(vao, 4, 0);
+				glEnableVertexArrayAttrib(vao, 4);
+			}
+			vertexArrays[i] = vao;
+
+			//morph format, the bindings are pointed at two frames of the same mesh when drawing
+			glCreateVertexArrays(1, &vao);
+			glVertexArrayElementBuffer(vao, indexBuffer);
+			for (int binding = 0; binding < 2; binding++)
+			{
+				glVertexArrayVertexBuffer(vao, binding, vertexBuffer, 0, layout.stride);
+				glVertexArrayAttribFormat(vao, binding * 2, 3, layout.positionType, GL_FALSE, 0);
+				glVertexArrayAttribBinding(vao, binding * 2, binding);
+				glEnableVertexArrayAttrib(vao, binding * 2);
+				glVertexArrayAttribFormat(vao, binding * 2 + 1, layout.normalCount, layout.normalType, layout.normalNormalized, layout.normalOffset);
+				glVertexArrayAttribBinding(vao, binding * 2 + 1, binding);
+				glEnableVertexArrayAttrib(vao, binding * 2 + 1);
+			}
+			morphArrays[i] = vao;
+		}
+	}
+
+	~GeometryArena()
+	{
+		glDeleteVertexArrays((int)VertexFormat::count, vertexArrays);
+		glDeleteVertexArrays((int)VertexFormat::count, morphArrays);
+		glDeleteBuffers(1, &vertexBuffer);
+		glDeleteBuffers(1, &indexBuffer);
+	}
+
+	//copies the vertices and indices into the arena, returns false if the arena is full
+	bool Allocate(void* attribData, unsigned int attribSize, unsigned int stride, void* indexData, unsigned int indexSize, unsigned int indexStride, GeometryRange& range)
+	{
+		unsigned int vertexOffset = 0;
+		unsigned int indexOffset = 0;
+		if (!vertexSpace.Allocate(attribSize, stride, vertexOffset)) //align to the stride so the offset is a whole number of vertices
+			return false;
+		if (!indexSpace.Allocate(indexSize, indexStride, indexOffset))
+		{
+			vertexSpace.Free(vertexOffset, attribSize);
+			return false;
+		}
+		glNamedBufferSubData(vertexBuffer, vertexOffset, attribSize, attribData);
+		glNamedBufferSubData(indexBuffer, indexOffset, indexSize, indexData);
+		range.vertexOffset = vertexOffset;
+		range.vertexSize = attribSize;
+		range.indexOffset = indexOffset;
+		range.indexSize = indexSize;
+		range.baseVertex = vertexOffset / stride;
+		range.firstIndex = indexOffset / indexStride;
+		return true;
+	}
+
+	void Free(GeometryRange range)
+	{
+		vertexSpace.Free(range.vertexOffset, range.vertexSize);
+		indexSpace.Free(range.indexOffset, range.indexSize);
+	}
+
+	void Bind(VertexFormat format = VertexFormat::standard)
+	{
+		BindVertexArray(vertexArrays[(int)format]);
+	}
+
+	//bind the morph VAO with its bindings moved to the start of two frames, only the binding offsets change so no attribute is respecified
+	void BindMorph(VertexFormat format, GeometryRange& from, GeometryRange& to)
+	{
+		glm::uint vao = morphArrays[(int)format];
+		unsigned int stride = GetVertexLayout(format).stride;
+		glVertexArrayVertexBuffer(vao, 0, vertexBuffer, from.vertexOffset, stride);
+		glVertexArrayVertexBuffer(vao, 1, vertexBuffer, to.vertexOffset, stride);
+		BindVertexArray(vao);
+	}
+
+	glm::uint GetVertexBuffer()
+	{
+		return vertexBuffer;
+	}
+
+	glm::uint GetIndexBuffer()
+	{
+		return indexBuffer;
+	}
+
+	glm::uint GetVertexArray(VertexFormat format)
+	{
+		return vertexArrays[(int)format];
+	}
+};
+GeometryArena* geometryArena = nullptr;
+
+class GLObject
+{
+protected:
+	GLBuffer* attribBuffer;
+	GLBuffer* indexBuffer;
+	unsigned int indexCount = 0;
+	unsigned int triCount = 0;
+	glm::uint object = 0;
+	bool arenaBacked = false; //if true the geometry lives in geometryArena and we have no buffers or VAO of our own
+	GeometryRange range;
+	VertexFormat format = VertexFormat::standard;
+	GLenum indexType = GL_UNSIGNED_INT;
+
+public:
+	GLObject(const GLObject&) = delete; //share a MeshData instead of copying GPU buffers
+	GLObject(void* attribData, unsigned int size, int attribOffset = 0)
+	{
+		attribBuffer = new GLBuffer(attribData, size); //create vertex attribute buffer
+		indexBuffer = nullptr; //no index buffer
+		triCount = size / sizeof(Vertex); //number of tris in buffer (5 floats per tri)
+		indexCount = 0; //not using indexed rendering so doesn't matter
+		glGenVertexArrays(1, &object); //generate the VAO
+		BindVertexArray(object); //bind it
+		glBindBuffer(GL_ARRAY_BUFFER, attribBuffer->GetBuffer()); //bind the attrib buff to the VAO
+		SetupAttributes(attribOffset); //setup the vertex attributes
+		BindVertexArray(0); //unbind for safety
+	}
+
+	//attribData must already be in _format and indexData in _indexType (see PackVertices and PackIndices)
+	GLObject(void* attribData, unsigned int attribSize, void* indexData, unsigned int indexSize, int attribOffset = 0, bool useArena = true,
+		VertexFormat _format = VertexFormat::standard, GLenum _indexType = GL_UNSIGNED_INT)
+	{
+		format = _format;
+		indexType = _indexType;
+		unsigned int stride = GetVertexLayout(format).stride;
+		triCount = attribSize / stride;
+		indexCount = indexSize / GetIndexSize(indexType);
+		if (useArena && attribOffset == 0 && geometryArena != nullptr) //if we can live in the arena
+		{
+			arenaBacked = geometryArena->Allocate(attribData, attribSize, stride, indexData, indexSize, GetIndexSize(indexType), range);
+			if (arenaBacked)
+			{
+				attribBuffer = nullptr;
+				indexBuffer = nullptr;
+				return;
+			}
+			std::cout << "Warning: Geometry arena is full, falling back to separate buffers!\n";
+		}
+		attribBuffer = new GLBuffer(attribData, attribSize); //create vertex attribute buffer
+		indexBuffer = new GLBuffer(indexData, indexSize); //create vertex index buffer
+		glGenVertexArrays(1, &object); //..
+		BindVertexArray(object); //..
+		glBindBuffer(GL_ARRAY_BUFFER, attribBuffer->GetBuffer()); //..
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->GetBuffer()); //bind the index buff to VAO
+		SetupAttributes(attribOffset); //..
+		BindVertexArray(0); //..
+	}
+
+	~GLObject()
+	{
+		if (arenaBacked)
+		{
+			geometryArena->Free(range); //give our space back to the arena
+			return;
+		}
+		delete attribBuffer; //delete buffers
+		delete indexBuffer; //(delete on nullptr is safe)
+		if (boundVertexArray == object)
+			BindVertexArray(0);
+		glDeleteVertexArrays(1, &object); //delete VAO
+	}
+	void SetupAttributes()
+	{
+		SetupAttributes(0);
+	}
+
+	void SetupAttributes(int offset)
+	{
+		VertexLayout layout = GetVertexLayout(format);
+		glVertexAttribPointer(0 + offset, 3, layout.positionType, GL_FALSE, layout.stride, (void*)0); //index, count, type, normalize?, stride, offset
+		glEnableVertexAttribArray(0 + offset); //enable attribute
+		glVertexAttribPointer(1 + offset, layout.normalCount, layout.normalType, layout.normalNormalized, layout.stride, (void*)(unsigned long long int)layout.normalOffset);
+		glEnableVertexAttribArray(1 + offset);
+		if (offset == 0 && layout.hasUV && format != VertexFormat::standard)
+		{
+			glVertexAttribPointer(4, 2, layout.uvType, GL_FALSE, layout.stride, (void*)(unsigned long long int)layout.uvOffset);
+			glEnableVertexAttribArray(4);
+		}
+	}
+
+	//the buffer must hold vertices in the same format as ours (eg the next frame of an animation)
+	void SetupAttributes(int offset, int buffer)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buffer); //bind buffer
+		SetupAttributes(offset);
+	}
+
+	void Draw()
+	{
+		if (arenaBacked)
+		{
+			geometryArena->Bind(format); //only rebinds if a different VAO was used since
+			glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, indexType, (void*)((unsigned long long int)range.firstIndex * GetIndexSize(indexType)), range.baseVertex);
+			return;
+		}
+		BindVertexArray(object);
+		if (indexBuffer != nullptr)
+			glDrawElements(GL_TRIANGLES, indexCount, indexType, (void*)0); //draw mode, count, typeof index, offset
+		else //if not using vertex indices
+			glDrawArrays(GL_TRIANGLES, 0, triCount); //regular draw
+	}
+
+	//draw count copies, the shader tells them apart with gl_InstanceID
+	void DrawInstanced(unsigned int count)
+	{
+		if (arenaBacked)
+		{
+			geometryArena->Bind(format);
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, indexCount, indexType, (void*)((unsigned long long int)range.firstIndex * GetIndexSize(indexType)), count, range.baseVertex);
+			return;
+		}
+		BindVertexArray(object);
+		if (indexBuffer != nullptr)
+			glDrawElementsInstanced(GL_TRIANGLES, indexCount, indexType, (void*)0, count);
+		else
+			glDrawArraysInstanced(GL_TRIANGLES, 0, triCount, count);
+	}
+
+	//draw blended towards next's vertices (see the animated shaders), next must be the same mesh in another pose
+	//animFac is the value the caller set at animFacLocation, so it can be put back without reading it from the driver
+	void DrawMorph(GLObject* next, int animFacLocation, float animFac)
+	{
+		if (arenaBacked && next->arenaBacked && next->format == format)
+		{
+			geometryArena->BindMorph(format, range, next->range);
+			//the binding offsets already point at our vertices so no base vertex
+			glDrawElements(GL_TRIANGLES, indexCount, indexType, (void*)((unsigned long long int)range.firstIndex * GetIndexSize(indexType)));
+			return;
+		}
+		if (arenaBacked || next->arenaBacked) //if only one of them fit in the arena we have nothing to blend with
+		{
+			//the arena VAO has no next frame attributes so they'd read as 0, draw this frame unblended instead
+			if (animFacLocation >= 0)
+				glUniform1f(animFacLocation, 0.00f);
+			Draw();
+			if (animFacLocation >= 0) //the other meshes of the frame may still blend
+				glUniform1f(animFacLocation, animFac);
+			return;
+		}
+		BindVertexArray(object); //both have their own buffers, so fall back to respecifying our VAO's next frame attributes
+		SetupAttributes(2, next->attribBuffer->GetBuffer());
+		Draw();
+	}
+
+	GLBuffer* GetAttribBuffer()
+	{
+		return attribBuffer;
+	}
+
+	GLBuffer* GetIndexBuffer()
+	{
+		return indexBuffer;
+	}
+
+	unsigned int GetObject()
+	{
+		return object;
+	}
+
+	//the VAO Draw() will actually bind
+	unsigned int GetDrawVertexArray()
+	{
+		if (arenaBacked)
+			return geometryArena->GetVertexArray(format);
+		return object;
+	}
+
+	bool IsArenaBacked()
+	{
+		return arenaBacked;
+	}
+
+	GeometryRange GetRange()
+	{
+		return range;
+	}
+
+	unsigned int GetIndexCount()
+	{
+		return indexCount;
+	}
+
+	VertexFormat GetVertexFormat()
+	{
+		return format;
+	}
+
+	GLenum GetIndexType()
+	{
+		return indexType;
+	}
+};
+
+//axis aligned box and sphere around a mesh's vertices in model space
+struct Bounds
+{
+	glm::vec3 min = glm::vec3(0.00f);
+	glm::vec3 max = glm::vec3(0.00f);
+	glm::vec3 sphereCenter = glm::vec3(0.00f);
+	float sphereRadius = 0.00f;
+
+	Bounds()
+	{
+	}
+
+	Bounds(Vertex* vertices, unsigned int numVerts)
+	{
+		if (numVerts == 0)
+			return;
+		min = vertices[0].pos;
+		max = vertices[0].pos;
+		for (unsigned int i = 1; i < numVerts; i++) //grow the box to fit every vertex
+		{
+			min = glm::min(min, vertices[i].pos);
+			max = glm::max(max, vertices[i].pos);
+		}
+		sphereCenter = (min + max) * 0.50f;
+		for (unsigned int i = 0; i < numVerts; i++) //grow the sphere to fit every vertex
+		{
+			sphereRadius = glm::max(sphereRadius, glm::length(vertices[i].pos - sphereCenter));
+		}
+	}
+
+	glm::vec3 GetCenter()
+	{
+		return (min + max) * 0.50f;
+	}
+
+	glm::vec3 GetExtent()
+	{
+		return (max - min) * 0.50f;
+	}
+};
+
+//vertices and triangle list of a mesh on the CPU, used while importing before the data goes to the GPU
+struct MeshGeometry
+{
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices; //3 per triangle
+};
+
+//copy an assimp mesh into geometry, returns false if the mesh can't be used
+bool LoadMeshGeometry(aiMesh* mesh, MeshGeometry& geometry)
+{
+	unsigned int numVerts = mesh->mNumVertices;
+	if (numVerts == 0) //if it has no verts
+	{
+		std::cout << "Error: Failed to create mesh! No vertices!\n";
+		return false; //fail (no verts)
+	}
+	geometry.vertices.resize(numVerts); //alloc
+	for (unsigned int vert = 0; vert < numVerts; vert++) //loop over each vert
+	{
+		geometry.vertices[vert] = Vertex{ FromAssimpVec(mesh->mVertices[vert]),
+			FromAssimpVec(mesh->mNormals[vert]),
+			glm::vec2(mesh->mTextureCoords[0][vert].x, mesh->mTextureCoords[0][vert].y) }; //extract and store the info in a Vertex struct
+	}
+	unsigned int numFaces = mesh->mNumFaces; //get number of faces
+	geometry.indices.resize(numFaces * 3); //3 indices per face
+	for (unsigned int face = 0; face < numFaces; face++) //loop over faces
+	{
+		aiFace currFace = mesh->mFaces[face];
+		if (currFace.mNumIndices != 3) //make sure its a triangle
+		{
+			std::cout << "Error: Failed to create mesh indices!: Face not a triangle! \n";
+			return false; //fail not a triangle
+		}
+		geometry.indices[face * 3] = currFace.mIndices[0]; //set each index
+		geometry.indices[face * 3 + 1] = currFace.mIndices[1];
+		geometry.indices[face * 3 + 2] = currFace.mIndices[2];
+	}
+	return true;
+}
+
+//convert float vertices into format, the returned bytes go straight into a GLObject
+std::vector<unsigned char> PackVertices(std::vector<Vertex>& vertices, VertexFormat format)
+{
+	VertexLayout layout = GetVertexLayout(format);
+	std::vector<unsigned char> data(vertices.size() * layout.stride);
+	for (unsigned long long int i = 0; i < vertices.size(); i++)
+	{
+		unsigned char* out = data.data() + i * layout.stride;
+		Vertex& vertex = vertices[i];
+		if (format == VertexFormat::standard)
+		{
+			memcpy(out, &vertex, sizeof(Vertex));
+			continue;
+		}
+		if (layout.positionType == GL_HALF_FLOAT)
+		{
+			glm::uint64 position = glm::packHalf4x16(glm::vec4(vertex.pos, 1.00f));
+			memcpy(out, &position, sizeof(position));
+		}
+		else
+			memcpy(out, &vertex.pos, sizeof(glm::vec3));
+		glm::uint32 normal = glm::packSnorm3x10_1x2(glm::vec4(glm::normalize(vertex.normal), 0.00f)); //x in the low 10 bits like GL_INT_2_10_10_10_REV expects
+		memcpy(out + layout.normalOffset, &normal, sizeof(normal));
+		if (layout.hasUV)
+		{
+			glm::uint32 uv = glm::packHalf2x16(vertex.uv);
+			memcpy(out + layout.uvOffset, &uv, sizeof(uv));
+		}
+	}
+	return data;
+}
+
+//convert indices into indexType, the returned bytes go straight into a GLObject
+std::vector<unsigned char> PackIndices(std::vector<unsigned int>& indices, GLenum indexType)
+{
+	if (indexType == GL_UNSIGNED_INT)
+	{
+		std::vector<unsigned char> data(indices.size() * sizeof(unsigned int));
+		memcpy(data.data(), indices.data(), data.size());
+		return data;
+	}
+	std::vector<unsigned char> data(indices.size() * sizeof(unsigned short));
+	unsigned short* out = reinterpret_cast<unsigned short*>(data.data());
+	for (unsigned long long int i = 0; i < indices.size(); i++)
+	{
+		out[i] = (unsigned short)indices[i];
+	}
+	return data;
+}
+
+//average number of vertex shader runs per triangle with a FIFO post transform cache of cacheSize entries
+//0.5 is the best a big grid can do, 3 means no vertex was reused
+float CalculateACMR(std::vector<unsigned int>& indices, unsigned int vertexCount, unsigned int cacheSize = 16)
+{
+	if (indices.size() < 3)
+		return 0.00f;
+	std::vector<unsigned int> timestamps(vertexCount, 0);
+	unsigned int time = cacheSize + 1; //so nothing starts in the cache
+	unsigned int misses = 0;
+	for (unsigned long long int i = 0; i < indices.size(); i++)
+	{
+		unsigned int vertex = indices[i];
+		if (time - timestamps[vertex] > cacheSize) //if it was pushed out (or never went in)
+		{
+			timestamps[vertex] = time; //push it into the cache
+			time++;
+			misses++;
+		}
+	}
+	return (float)misses / (float)(indices.size() / 3);
+}
+
+struct MeshOptimizeStats
+{
+	unsigned int triangles = 0;
+	unsigned int verticesBefore = 0;
+	unsigned int verticesAfter = 0;
+	float missesBefore = 0.00f; //ACMR * triangles, so stats of several meshes can be added together
+	float missesAfter = 0.00f;
+
+	void Add(MeshOptimizeStats other)
+	{
+		triangles += other.triangles;
+		verticesBefore += other.verticesBefore;
+		verticesAfter += other.verticesAfter;
+		missesBefore += other.missesBefore;
+		missesAfter += other.missesAfter;
+	}
+
+	float GetACMRBefore()
+	{
+		return triangles > 0 ? missesBefore / triangles : 0.00f;
+	}
+
+	float GetACMRAfter()
+	{
+		return triangles > 0 ? missesAfter / triangles : 0.00f;
+	}
+};
+MeshOptimizeStats importStats; //totals of every mesh optimized since the last reset, Model prints them after loading
+
+//merge vertices that are bit for bit identical, assimp gives every face its own copies for OBJs
+void WeldVertices(MeshGeometry& geometry)
+{
+	struct VertexHash
+	{
+		size_t operator()(const Vertex& vertex) const
+		{
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&vertex);
+			size_t hash = 14695981039346656037ull; //FNV-1a
+			for (unsigned int i = 0; i < sizeof(Vertex); i++)
+			{
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+			return hash;
+		}
+	};
+	struct VertexEqual
+	{
+		bool operator()(const Vertex& a, const Vertex& b) const
+		{
+			return memcmp(&a, &b, sizeof(Vertex)) == 0;
+		}
+	};
+	std::unordered_map<Vertex, unsigned int, VertexHash, VertexEqual> unique;
+	unique.reserve(geometry.vertices.size());
+	std::vector<unsigned int> remap(geometry.vertices.size());
+	std::vector<Vertex> vertices;
+	for (unsigned long long int i = 0; i < geometry.vertices.size(); i++)
+	{
+		auto found = unique.find(geometry.vertices[i]);
+		if (found == unique.end()) //if this is the first copy
+		{
+			found = unique.emplace(geometry.vertices[i], (unsigned int)vertices.size()).first;
+			vertices.push_back(geometry.vertices[i]);
+		}
+		remap[i] = found->second;
+	}
+	for (unsigned long long int i = 0; i < geometry.indices.size(); i++)
+	{
+		geometry.indices[i] = remap[geometry.indices[i]];
+	}
+	geometry.vertices = vertices;
+}
+
+//reorder triangles so vertices are reused while they are still in the post transform cache
+//greedy, always emits the triangle whose vertices score best, see Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+void OptimizeVertexCache(MeshGeometry& geometry)
+{
+	const unsigned int cacheSize = 32; //modelled cache, bigger than the real one as the scores only need to be relative
+	unsigned int vertexCount = (unsigned int)geometry.vertices.size();
+	unsigned int triangleCount = (unsigned int)(geometry.indices.size() / 3);
+	if (triangleCount == 0)
+		return;
+
+	//triangles using each vertex, packed into one array
+	std::vector<unsigned int> remaining(vertexCount, 0); //triangles using the vertex that haven't been emitted yet
+	for (unsigned long long int i = 0; i < geometry.indices.size(); i++)
+	{
+		remaining[geometry.indices[i]]++;
+	}
+	std::vector<unsigned int> firstTriangle(vertexCount + 1, 0);
+	for (unsigned int v = 0; v < vertexCount; v++)
+	{
+		firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+	}
+	std::vector<unsigned int> adjacency(geometry.indices.size());
+	std::vector<unsigned int> filled(vertexCount, 0);
+	for (unsigned int t = 0; t < triangleCount; t++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			unsigned int v = geometry.indices[t * 3 + c];
+			adjacency[firstTriangle[v] + filled[v]] = t;
+			filled[v]++;
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	auto VertexScore = [&](unsigned int v) -> float
+	{
+		if (remaining[v] == 0) //if nothing needs it anymore
+			return -1.00f;
+		float score = 0.00f;
+		int position = cachePosition[v];
+		if (position >= 0)
+		{
+			if (position < 3) //if it was used by the last triangle
+				score = 0.75f; //a little lower so we don't just make strips
+			else
+				score = powf(1.00f - (float)(position - 3) / (float)(cacheSize - 3), 1.50f);
+		}
+		score += 2.00f / sqrtf((float)remaining[v]); //prefer finishing off vertices with few triangles left so they don't get stranded
+		return score;
+	};
+
+	std::vector<float> vertexScores(vertexCount);
+	for (unsigned int v = 0; v < vertexCount; v++)
+	{
+		vertexScores[v] = VertexScore(v);
+	}
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	for (unsigned int t = 0; t < triangleCount; t++)
+	{
+		triangleScores[t] = vertexScores[geometry.indices[t * 3]] + vertexScores[geometry.indices[t * 3 + 1]] + vertexScores[geometry.indices[t * 3 + 2]];
+	}
+
+	std::vector<unsigned int> result;
+	result.reserve(geometry.indices.size());
+	std::vector<unsigned int> cache;
+	std::vector<unsigned int> newCache;
+	unsigned int nextUnemitted = 0; //where to look when nothing in the cache has triangles left
+	int best = -1;
+	for (unsigned int emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		if (best < 0) //if the cache gave us nothing, start again from the next unemitted triangle
+		{
+			while (emitted[nextUnemitted])
+				nextUnemitted++;
+			best = (int)nextUnemitted;
+		}
+		unsigned int* triangle = &geometry.indices[best * 3];
+		emitted[best] = true;
+		newCache.clear();
+		for (int c = 0; c < 3; c++)
+		{
+			unsigned int v = triangle[c];
+			result.push_back(v);
+			newCache.push_back(v);
+			unsigned int* triangles = &adjacency[firstTriangle[v]];
+			for (unsigned int i = 0; i < remaining[v]; i++) //remove the triangle from the vertex's list
+			{
+				if (triangles[i] == (unsigned int)best)
+				{
+					triangles[i] = triangles[remaining[v] - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+		for (unsigned long long int i = 0; i < cache.size(); i++) //the rest of the old cache goes behind the new triangle
+		{
+			unsigned int v = cache[i];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				newCache.push_back(v);
+		}
+		std::swap(cache, newCache);
+		for (unsigned long long int i = 0; i < cache.size(); i++)
+		{
+			cachePosition[cache[i]] = i < cacheSize ? (int)i : -1;
+		}
+		if (cache.size() > cacheSize) //the vertices that fell out still need their scores updating below
+			cache.resize(cacheSize + 3);
+
+		for (unsigned long long int i = 0; i < cache.size(); i++) //only triangles touching the cache changed score
+		{
+			unsigned int v = cache[i];
+			float oldScore = vertexScores[v];
+			vertexScores[v] = VertexScore(v);
+			unsigned int* triangles = &adjacency[firstTriangle[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++)
+			{
+				triangleScores[triangles[j]] += vertexScores[v] - oldScore;
+			}
+		}
+		if (cache.size() > cacheSize)
+			cache.resize(cacheSize);
+
+		best = -1;
+		float bestScore = -1.00f;
+		for (unsigned long long int i = 0; i < cache.size(); i++)
+		{
+			unsigned int v = cache[i];
+			unsigned int* triangles = &adjacency[firstTriangle[v]];
+			for (unsigned int j = 0; j < remaining[v]; j++)
+			{
+				if (triangleScores[triangles[j]] > bestScore)
+				{
+					bestScore = triangleScores[triangles[j]];
+					best = (int)triangles[j];
+				}
+			}
+		}
+	}
+	geometry.indices = result;
+}
+
+//reorder groups of triangles so the ones facing away from the middle of the mesh are drawn first, they are the most likely to hide the rest
+//groups are split where the vertex cache would be cold anyway so the cache order is kept
+void OptimizeOverdraw(MeshGeometry& geometry)
+{
+	const unsigned int cacheSize = 16;
+	unsigned int triangleCount = (unsigned int)(geometry.indices.size() / 3);
+	if (triangleCount == 0)
+		return;
+
+	std::vector<unsigned int> clusterStarts;
+	std::vector<unsigned int> timestamps(geometry.vertices.size(), 0);
+	unsigned int time = cacheSize + 1;
+	for (unsigned int t = 0; t < triangleCount; t++)
+	{
+		unsigned int misses = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			unsigned int v = geometry.indices[t * 3 + c];
+			if (time - timestamps[v] > cacheSize)
+			{
+				timestamps[v] = time;
+				time++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3) //if nothing was reused we can start a new cluster for free
+			clusterStarts.push_back(t);
+	}
+	clusterStarts.push_back(triangleCount);
+
+	glm::vec3 meshCentroid = glm::vec3(0.00f);
+	for (unsigned long long int i = 0; i < geometry.vertices.size(); i++)
+	{
+		meshCentroid += geometry.vertices[i].pos;
+	}
+	meshCentroid /= (float)geometry.vertices.size();
+
+	struct Cluster
+	{
+		unsigned int start;
+		unsigned int end;
+		float sortKey;
+	};
+	std::vector<Cluster> clusters;
+	for (unsigned long long int i = 0; i + 1 < clusterStarts.size(); i++)
+	{
+		glm::vec3 centroid = glm::vec3(0.00f);
+		glm::vec3 normal = glm::vec3(0.00f);
+		float area = 0.00f;
+		for (unsigned int t = clusterStarts[i]; t < clusterStarts[i + 1]; t++)
+		{
+			glm::vec3 a = geometry.vertices[geometry.indices[t * 3]].pos;
+			glm::vec3 b = geometry.vertices[geometry.indices[t * 3 + 1]].pos;
+			glm::vec3 c = geometry.vertices[geometry.indices[t * 3 + 2]].pos;
+			glm::vec3 cross = glm::cross(b - a, c - a); //length is twice the area
+			float triangleArea = glm::length(cross);
+			centroid += (a + b + c) * (triangleArea / 3.00f); //area weighted
+			normal += cross;
+			area += triangleArea;
+		}
+		float sortKey = 0.00f;
+		if (area > 0.00f && glm::length(normal) > 0.00f)
+			sortKey = glm::dot(centroid / area - meshCentroid, glm::normalize(normal));
+		clusters.push_back(Cluster{ clusterStarts[i], clusterStarts[i + 1], sortKey });
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; }); //most outward facing first
+
+	std::vector<unsigned int> result;
+	result.reserve(geometry.indices.size());
+	for (unsigned long long int i = 0; i < clusters.size(); i++)
+	{
+		result.insert(result.end(), geometry.indices.begin() + clusters[i].start * 3, geometry.indices.begin() + clusters[i].end * 3);
+	}
+	geometry.indices = result;
+}
+
+//reorder the vertices into the order the index buffer first uses them so fetches walk through memory
+//also drops any vertex no triangle uses
+void OptimizeVertexFetch(MeshGeometry& geometry)
+{
+	const unsigned int unused = 0xFFFFFFFF;
+	std::vector<unsigned int> remap(geometry.vertices.size(), unused);
+	std::vector<Vertex> vertices;
+	vertices.reserve(geometry.vertices.size());
+	for (unsigned long long int i = 0; i < geometry.indices.size(); i++)
+	{
+		unsigned int v = geometry.indices[i];
+		if (remap[v] == unused) //if this is the first use
+		{
+			remap[v] = (unsigned int)vertices.size();
+			vertices.push_back(geometry.vertices[v]);
+		}
+		geometry.indices[i] = remap[v];
+	}
+	geometry.vertices = vertices;
+}
+
+//weld, then order for the vertex cache, overdraw and vertex fetch in that order as each step keeps the previous one mostly intact
+MeshOptimizeStats OptimizeMeshGeometry(MeshGeometry& geometry)
+{
+	MeshOptimizeStats stats;
+	stats.triangles = (unsigned int)(geometry.indices.size() / 3);
+	stats.verticesBefore = (unsigned int)geometry.vertices.size();
+	stats.missesBefore = CalculateACMR(geometry.indices, (unsigned int)geometry.vertices.size()) * stats.triangles;
+	WeldVertices(geometry);
+	OptimizeVertexCache(geometry);
+	OptimizeOverdraw(geometry);
+	OptimizeVertexFetch(geometry);
+	stats.verticesAfter = (unsigned int)geometry.vertices.size();
+	stats.missesAfter = CalculateACMR(geometry.indices, (unsigned int)geometry.vertices.size()) * stats.triangles;
+	return stats;
+}
+
+//a simplified copy of a mesh and how far its vertices moved from the original in model space
+struct MeshLod
+{
+	MeshGeometry geometry;
+	float error = 0.00f;
+};
+
+//orders positions exactly so they can be kept in a sorted vector and found with a binary search
+struct PositionLess
+{
+	bool operator()(const glm::vec3& a, const glm::vec3& b) const
+	{
+		if (a.x != b.x)
+			return a.x < b.x;
+		if (a.y != b.y)
+			return a.y < b.y;
+		return a.z < b.z;
+	}
+};
+
+//the grid LODs are snapped to, the clusters of one mesh share their parent's so neighbours simplify the same way
+struct LodGrid
+{
+	glm::vec3 origin = glm::vec3(0.00f);
+	float size = 0.00f; //longest side of the bounds the grid covers, 0 fits it to the mesh being simplified
+	std::vector<glm::vec3> lockedPositions; //sorted by PositionLess, vertices here never move (cluster borders)
+};
+
+//vertex clustering: every vertex in a cellSize cube moves to the cube's average position and triangles that collapse are dropped
+//vertices keep their own normal per dominant axis so hard edges stay hard, locked vertices get a cell of their own and stay put
+//error is set to the furthest any vertex moved
+MeshGeometry SimplifyByClustering(MeshGeometry& geometry, glm::vec3 origin, float cellSize, std::vector<glm::vec3>& lockedPositions, float& error)
+{
+	std::unordered_map<unsigned long long int, unsigned int> cellIndices; //cell -> index into cellSums
+	std::vector<glm::vec4> cellSums; //xyz = summed positions, w = count
+	std::vector<unsigned int> vertexCells(geometry.vertices.size());
+	for (unsigned long long int i = 0; i < geometry.vertices.size(); i++)
+	{
+		glm::uvec3 cell = glm::uvec3(glm::max((geometry.vertices[i].pos - origin) / cellSize, glm::vec3(0.00f)));
+		unsigned long long int key = (unsigned long long int)cell.x | ((unsigned long long int)cell.y << 21) | ((unsigned long long int)cell.z << 42);
+		auto locked = std::lower_bound(lockedPositions.begin(), lockedPositions.end(), geometry.vertices[i].pos, PositionLess());
+		if (locked != lockedPositions.end() && *locked == geometry.vertices[i].pos) //top bit is free in grid keys
+			key = (1ull << 63) | (unsigned long long int)(locked - lockedPositions.begin());
+		auto found = cellIndices.find(key);
+		if (found == cellIndices.end())
+		{
+			found = cellIndices.emplace(key, (unsigned int)cellSums.size()).first;
+			cellSums.push_back(glm::vec4(0.00f));
+		}
+		cellSums[found->second] += glm::vec4(geometry.vertices[i].pos, 1.00f);
+		vertexCells[i] = found->second;
+	}
+
+	MeshGeometry result;
+	std::unordered_map<unsigned long long int, unsigned int> outputIndices; //cell and normal axis -> output vertex
+	std::vector<glm::vec3> normalSums;
+	std::vector<unsigned int> remap(geometry.vertices.size());
+	for (unsigned long long int i = 0; i < geometry.vertices.size(); i++)
+	{
+		glm::vec3 normal = geometry.vertices[i].normal;
+		glm::vec3 absNormal = glm::abs(normal);
+		unsigned int axis = absNormal.x > absNormal.y ? (absNormal.x > absNormal.z ? 0 : 2) : (absNormal.y > absNormal.z ? 1 : 2);
+		axis = axis * 2 + (normal[axis] < 0.00f ? 1 : 0);
+		unsigned long long int key = (unsigned long long int)vertexCells[i] * 6 + axis;
+		auto found = outputIndices.find(key);
+		if (found == outputIndices.end())
+		{
+			found = outputIndices.emplace(key, (unsigned int)result.vertices.size()).first;
+			glm::vec4 sum = cellSums[vertexCells[i]];
+			result.vertices.push_back(Vertex{ glm::vec3(sum) / sum.w, glm::vec3(0.00f), geometry.vertices[i].uv });
+			normalSums.push_back(glm::vec3(0.00f));
+		}
+		normalSums[found->second] += normal;
+		remap[i] = found->second;
+	}
+	error = 0.00f;
+	for (unsigned long long int i = 0; i < geometry.vertices.size(); i++)
+	{
+		error = glm::max(error, glm::length(geometry.vertices[i].pos - result.vertices[remap[i]].pos));
+	}
+	for (unsigned long long int i = 0; i < result.vertices.size(); i++)
+	{
+		result.vertices[i].normal = glm::length(normalSums[i]) > 0.00f ? glm::normalize(normalSums[i]) : glm::vec3(0.00f, 1.00f, 0.00f);
+	}
+
+	for (unsigned long long int i = 0; i + 2 < geometry.indices.size(); i += 3)
+	{
+		unsigned int a = geometry.indices[i], b = geometry.indices[i + 1], c = geometry.indices[i + 2];
+		if (vertexCells[a] == vertexCells[b] || vertexCells[b] == vertexCells[c] || vertexCells[a] == vertexCells[c]) //if it collapsed
+			continue;
+		result.indices.push_back(remap[a]);
+		result.indices.push_back(remap[b]);
+		result.indices.push_back(remap[c]);
+	}
+	return result;
+}
+
+//longest side of the box around positions, min is set to its lowest corner
+float GetLongestSide(std::vector<Vertex>& vertices, glm::vec3& min)
+{
+	if (vertices.empty())
+		return 0.00f;
+	min = vertices[0].pos;
+	glm::vec3 max = min;
+	for (unsigned long long int i = 1; i < vertices.size(); i++)
+	{
+		min = glm::min(min, vertices[i].pos);
+		max = glm::max(max, vertices[i].pos);
+	}
+	return glm::max(max.x - min.x, glm::max(max.y - min.y, max.z - min.z));
+}
+
+//build up to maxLods coarser versions of geometry, each with about half the triangles of the one before
+//stops early once a mesh is too small to be worth simplifying further
+std::vector<MeshLod> GenerateLods(MeshGeometry& geometry, unsigned int maxLods, LodGrid& grid)
+{
+	const unsigned int minTriangles = 64;
+	std::vector<MeshLod> lods;
+	glm::vec3 min;
+	float size = GetLongestSide(geometry.vertices, min);
+	if (size <= 0.00f)
+		return lods;
+	float gridSize = size;
+	if (grid.size > 0.00f) //snap to the shared grid instead of our own bounds
+	{
+		min = grid.origin;
+		gridSize = grid.size;
+	}
+
+	unsigned int previousTriangles = (unsigned int)(geometry.indices.size() / 3);
+	unsigned int maxResolution = (unsigned int)glm::min(1024.00f * gridSize / size, 1048576.00f); //cells along the grid's longest side, as fine as 1024 across the mesh
+	for (unsigned int lod = 0; lod < maxLods; lod++)
+	{
+		unsigned int target = previousTriangles / 2;
+		if (target < minTriangles)
+			break;
+		//find the finest grid that reaches the target (triangle count falls as the cells get bigger)
+		unsigned int low = 1;
+		unsigned int high = maxResolution;
+		MeshGeometry best;
+		unsigned int bestResolution = 0;
+		float bestError = 0.00f;
+		while (low <= high)
+		{
+			unsigned int resolution = (low + high) / 2;
+			float error;
+			MeshGeometry simplified = SimplifyByClustering(geometry, min, gridSize / resolution, grid.lockedPositions, error);
+			if (simplified.indices.size() / 3 <= target)
+			{
+				best = simplified;
+				bestResolution = resolution;
+				bestError = error;
+				low = resolution + 1;
+			}
+			else
+				high = resolution - 1;
 		}
-		glGenVertexArrays(1, &object); //..
-		glBindVertexArray(object); //..
-		glBindBuffer(GL_ARRAY_BUFFER, attribBuffer->GetBuffer()); //..
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->GetBuffer()); //bind the index buff to VAO
-		SetupAttributes(); //..
-		glBindVertexArray(0); //..
+		unsigned int triangles = (unsigned int)(best.indices.size() / 3);
+		if (bestResolution == 0 || triangles == 0 || triangles > previousTriangles * 0.80f) //if nothing fits or it barely helped
+			break;
+		MeshLod meshLod;
+		meshLod.geometry = best;
+		meshLod.error = bestError;
+		OptimizeVertexCache(meshLod.geometry);
+		OptimizeVertexFetch(meshLod.geometry);
+		lods.push_back(meshLod);
+		previousTriangles = triangles;
+		maxResolution = bestResolution; //coarser LODs need bigger cells
 	}
+	return lods;
+}
 
-	~GLObject()
+//split geometry into spatially compact clusters of at most maxTriangles triangles so each can be culled on its own
+//triangles are split at the median of their centroids along the longest axis until every cluster is small enough
+std::vector<MeshGeometry> SplitIntoClusters(MeshGeometry& geometry, unsigned int maxTriangles)
+{
+	std::vector<MeshGeometry> clusters;
+	unsigned int numTris = (unsigned int)geometry.indices.size() / 3;
+	std::vector<glm::vec3> centroids(numTris);
+	std::vector<unsigned int> triangles(numTris);
+	for (unsigned int tri = 0; tri < numTris; tri++)
 	{
-		delete attribBuffer; //delete buffers
-		delete indexBuffer; //(delete on nullptr is safe)
-		glDeleteVertexArrays(1, &object); //delete VAO
+		centroids[tri] = (geometry.vertices[geometry.indices[tri * 3]].pos + geometry.vertices[geometry.indices[tri * 3 + 1]].pos
+			+ geometry.vertices[geometry.indices[tri * 3 + 2]].pos) / 3.00f;
+		triangles[tri] = tri;
 	}
 
-	void SetupAttributes()
+	std::vector<glm::uvec2> ranges; //ranges of triangles left to split (first, count)
+	ranges.push_back(glm::uvec2(0, numTris));
+	std::vector<unsigned int> remap(geometry.vertices.size(), 0xFFFFFFFF); //old vertex index to index in the current cluster
+	while (!ranges.empty())
 	{
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0); //index, count, type, normalize?, stride, offset
-		glEnableVertexAttribArray(0); //enable attribute
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Vertex::normal));
-		glEnableVertexAttribArray(1);
+		glm::uvec2 range = ranges.back();
+		ranges.pop_back();
+		if (range.y > maxTriangles) //too big, split in half
+		{
+			glm::vec3 min = centroids[triangles[range.x]];
+			glm::vec3 max = min;
+			for (unsigned int i = range.x; i < range.x + range.y; i++)
+			{
+				min = glm::min(min, centroids[triangles[i]]);
+				max = glm::max(max, centroids[triangles[i]]);
+			}
+			glm::vec3 size = max - min;
+			int axis = 0; //split along the longest axis
+			if (size.y > size[axis])
+				axis = 1;
+			if (size.z > size[axis])
+				axis = 2;
+			unsigned int half = range.y / 2;
+			std::nth_element(triangles.begin() + range.x, triangles.begin() + range.x + half, triangles.begin() + range.x + range.y,
+				[&](unsigned int a, unsigned int b) { return centroids[a][axis] < centroids[b][axis]; }); //partition around the median
+			ranges.push_back(glm::uvec2(range.x, half));
+			ranges.push_back(glm::uvec2(range.x + half, range.y - half));
+			continue;
+		}
+		//small enough, build the cluster with only the vertices it uses
+		MeshGeometry cluster;
+		for (unsigned int i = range.x; i < range.x + range.y; i++)
+		{
+			for (unsigned int corner = 0; corner < 3; corner++)
+			{
+				unsigned int index = geometry.indices[triangles[i] * 3 + corner];
+				if (remap[index] == 0xFFFFFFFF) //first time this cluster uses the vertex
+				{
+					remap[index] = (unsigned int)cluster.vertices.size();
+					cluster.vertices.push_back(geometry.vertices[index]);
+				}
+				cluster.indices.push_back(remap[index]);
+			}
+		}
+		for (unsigned int i = range.x; i < range.x + range.y; i++) //reset the remap for the next cluster
+		{
+			for (unsigned int corner = 0; corner < 3; corner++)
+			{
+				remap[geometry.indices[triangles[i] * 3 + corner]] = 0xFFFFFFFF;
+			}
+		}
+		clusters.push_back(cluster);
 	}
+	return clusters;
+}
 
-	void SetupAttributes(int offset)
+//positions used by more than one cluster, sorted by PositionLess, LODs must keep these so neighbouring clusters stay joined
+std::vector<glm::vec3> FindClusterBorders(std::vector<MeshGeometry>& clusters)
+{
+	std::vector<std::pair<glm::vec3, unsigned int>> uses; //position and the cluster using it
+	for (unsigned int i = 0; i < clusters.size(); i++)
 	{
-		glVertexAttribPointer(0 + offset, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0); //index, count, type, normalize?, stride, offset
-		glEnableVertexAttribArray(0 + offset); //enable attribute
-		glVertexAttribPointer(1 + offset, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Vertex::normal));
-		glEnableVertexAttribArray(1 + offset);
+		for (unsigned long long int v = 0; v < clusters[i].vertices.size(); v++)
+		{
+			uses.push_back(std::make_pair(clusters[i].vertices[v].pos, i));
+		}
 	}
+	std::sort(uses.begin(), uses.end(), [](const std::pair<glm::vec3, unsigned int>& a, const std::pair<glm::vec3, unsigned int>& b)
+		{ return PositionLess()(a.first, b.first); });
+	std::vector<glm::vec3> borders;
+	for (unsigned long long int i = 1; i < uses.size(); i++)
+	{
+		if (uses[i].first != uses[i - 1].first || uses[i].second == uses[i - 1].second) //a different position or the same cluster again
+			continue;
+		if (borders.empty() || borders.back() != uses[i].first)
+			borders.push_back(uses[i].first);
+	}
+	return borders;
+}
 
-	void SetupAttributes(int offset, int buffer)
+//the 6 planes of a view volume, normals point inwards
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	Frustum(glm::mat4 matrix)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, buffer); //bind buffer
-		glVertexAttribPointer(0 + offset, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0); //index, count, type, normalize?, stride, offset
-		glEnableVertexAttribArray(0 + offset); //enable attribute
-		glVertexAttribPointer(1 + offset, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Vertex::normal));
-		glEnableVertexAttribArray(1 + offset);
+		//extract the planes from the rows of the combined matrix (Gribb and Hartmann)
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+		{
+			rows[i] = glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+		}
+		planes[0] = rows[3] + rows[0]; //left
+		planes[1] = rows[3] - rows[0]; //right
+		planes[2] = rows[3] + rows[1]; //bottom
+		planes[3] = rows[3] - rows[1]; //top
+		planes[4] = rows[3] + rows[2]; //near
+		planes[5] = rows[3] - rows[2]; //far
+		for (int i = 0; i < 6; i++)
+		{
+			planes[i] /= glm::length(glm::vec3(planes[i])); //normalize so the distances are in world units
+		}
+	}
+};
+
+constexpr unsigned int noBoundsSlot = 0xFFFFFFFF;
+
+//world space boxes of every drawable mesh stored as structure of arrays so they can be culled 4 at a time
+class BoundsTable
+{
+protected:
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<unsigned int> freeSlots;
+
+public:
+	unsigned int Register()
+	{
+		if (freeSlots.empty()) //grow by 4 slots so the arrays always hold whole groups of 4
+		{
+			unsigned int first = (unsigned int)centerX.size();
+			for (unsigned int i = 0; i < 4; i++)
+			{
+				centerX.push_back(0.00f);
+				centerY.push_back(0.00f);
+				centerZ.push_back(0.00f);
+				extentX.push_back(0.00f);
+				extentY.push_back(0.00f);
+				extentZ.push_back(0.00f);
+				freeSlots.push_back(first + 3 - i); //push in reverse so the lowest slot is used first
+			}
+		}
+		unsigned int slot = freeSlots.back();
+		freeSlots.pop_back();
+		return slot;
+	}
+
+	void Unregister(unsigned int slot)
+	{
+		Set(slot, glm::vec3(0.00f), glm::vec3(0.00f));
+		freeSlots.push_back(slot);
+	}
+
+	void Set(unsigned int slot, glm::vec3 center, glm::vec3 extent)
+	{
+		centerX[slot] = center.x;
+		centerY[slot] = center.y;
+		centerZ[slot] = center.z;
+		extentX[slot] = extent.x;
+		extentY[slot] = extent.y;
+		extentZ[slot] = extent.z;
+	}
+
+	//writes 1 into visible for every box that is at least partly inside the frustum
+	void Cull(Frustum& frustum, std::vector<unsigned char>& visible)
+	{
+		unsigned int count = (unsigned int)centerX.size();
+		visible.resize(count);
+		for (unsigned int i = 0; i < count; i += 4) //test 4 boxes per iteration
+		{
+#ifdef USE_SSE
+			__m128 cx = _mm_loadu_ps(&centerX[i]);
+			__m128 cy = _mm_loadu_ps(&centerY[i]);
+			__m128 cz = _mm_loadu_ps(&centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&extentX[i]);
+			__m128 ey = _mm_loadu_ps(&extentY[i]);
+			__m128 ez = _mm_loadu_ps(&extentZ[i]);
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < 6; p++)
+			{
+				glm::vec4 plane = frustum.planes[p];
+				//distance from the plane to the box centre
+				__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+				//projected "radius" of the box onto the plane normal
+				__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(glm::abs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(glm::abs(plane.y)))),
+					_mm_mul_ps(ez, _mm_set1_ps(glm::abs(plane.z))));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps())); //outside if the whole box is behind any plane
+			}
+			int mask = _mm_movemask_ps(outside);
+			visible[i] = (mask & 1) == 0;
+			visible[i + 1] = (mask & 2) == 0;
+			visible[i + 2] = (mask & 4) == 0;
+			visible[i + 3] = (mask & 8) == 0;
+#else
+			bool outside[4] = { false, false, false, false };
+			for (int p = 0; p < 6; p++)
+			{
+				glm::vec4 plane = frustum.planes[p];
+				for (unsigned int j = 0; j < 4; j++)
+				{
+					float dist = centerX[i + j] * plane.x + centerY[i + j] * plane.y + centerZ[i + j] * plane.z + plane.w;
+					float radius = extentX[i + j] * glm::abs(plane.x) + extentY[i + j] * glm::abs(plane.y) + extentZ[i + j] * glm::abs(plane.z);
+					outside[j] = outside[j] || (dist + radius < 0.00f);
+				}
+			}
+			for (unsigned int j = 0; j < 4; j++)
+			{
+				visible[i + j] = !outside[j];
+			}
+#endif
+		}
+	}
+
+	unsigned int GetCapacity()
+	{
+		return (unsigned int)centerX.size();
+	}
+
+	glm::vec3 GetCenter(unsigned int slot)
+	{
+		return glm::vec3(centerX[slot], centerY[slot], centerZ[slot]);
+	}
+
+	glm::vec3 GetExtent(unsigned int slot)
+	{
+		return glm::vec3(extentX[slot], extentY[slot], extentZ[slot]);
+	}
+};
+BoundsTable worldBounds;
+
+//hierarchical Z occlusion culling against the depth of an earlier frame
+//the GPU reduces the depth buffer to the max of each blockSize x blockSize tile, that is read back through a PBO a frame later so nothing stalls
+//the rest of the pyramid is built on the CPU and each box is tested against the level where it covers about 2x2 texels
+class OcclusionCuller
+{
+protected:
+	static constexpr int numReadbacks = 2;
+	struct Readback
+	{
+		glm::uint buffer = 0;
+		GLsync fence = nullptr; //nullptr if there is nothing new in the buffer
+		glm::mat4 matrix = glm::mat4(1.00f); //view projection the depth was drawn with
+	};
+	Readback readbacks[numReadbacks];
+	int nextReadback = 0;
+	int width, height; //of the downsampled depth (level 0)
+	std::vector<std::vector<float>> levels; //max depth pyramid
+	std::vector<glm::ivec2> levelSizes;
+	glm::mat4 pyramidMatrix = glm::mat4(1.00f);
+	bool pyramidValid = false;
+	bool waitForNewest = false; //always cull against the previous frame's depth, stalling if need be
+	unsigned int tested = 0;
+	unsigned int occluded = 0;
+
+	void BuildPyramid()
+	{
+		for (unsigned long long int level = 1; level < levels.size(); level++)
+		{
+			glm::ivec2 sourceSize = levelSizes[level - 1];
+			glm::ivec2 size = levelSizes[level];
+			std::vector<float>& source = levels[level - 1];
+			for (int y = 0; y < size.y; y++)
+			{
+				int y0 = y * 2;
+				int y1 = glm::min(y0 + 1, sourceSize.y - 1); //odd sizes repeat the last row
+				for (int x = 0; x < size.x; x++)
+				{
+					int x0 = x * 2;
+					int x1 = glm::min(x0 + 1, sourceSize.x - 1);
+					levels[level][y * size.x + x] = glm::max(glm::max(source[y0 * sourceSize.x + x0], source[y0 * sourceSize.x + x1]),
+						glm::max(source[y1 * sourceSize.x + x0], source[y1 * sourceSize.x + x1]));
+				}
+			}
+		}
+	}
+
+	bool IsOccluded(glm::vec3 center, glm::vec3 extent)
+	{
+		glm::vec2 minUV = glm::vec2(1.00f);
+		glm::vec2 maxUV = glm::vec2(0.00f);
+		float minDepth = 1.00f;
+		for (int i = 0; i < 8; i++) //project each corner of the box
+		{
+			glm::vec3 corner = center + extent * glm::vec3((i & 1) ? 1.00f : -1.00f, (i & 2) ? 1.00f : -1.00f, (i & 4) ? 1.00f : -1.00f);
+			glm::vec4 clip = pyramidMatrix * glm::vec4(corner, 1.00f);
+			if (clip.w <= 0.0001f) //if the box crosses the camera plane it can't be behind anything
+				return false;
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+			minUV = glm::min(minUV, glm::vec2(ndc) * 0.50f + 0.50f);
+			maxUV = glm::max(maxUV, glm::vec2(ndc) * 0.50f + 0.50f);
+			minDepth = glm::min(minDepth, ndc.z * 0.50f + 0.50f);
+		}
+		if (maxUV.x < 0.00f || maxUV.y < 0.00f || minUV.x > 1.00f || minUV.y > 1.00f) //if it was off screen we know nothing about it
+			return false;
+		minUV = glm::clamp(minUV, glm::vec2(0.00f), glm::vec2(1.00f));
+		maxUV = glm::clamp(maxUV, glm::vec2(0.00f), glm::vec2(1.00f));
+		float texels = glm::max((maxUV.x - minUV.x) * width, (maxUV.y - minUV.y) * height);
+		int level = glm::min((int)ceilf(log2f(glm::max(texels, 1.00f))), (int)levels.size() - 1); //the rect is at most one texel wide here so it touches at most 2x2
+		glm::ivec2 size = levelSizes[level];
+		int x0 = glm::min((int)(minUV.x * width), width - 1) >> level;
+		int x1 = glm::min((int)(maxUV.x * width), width - 1) >> level;
+		int y0 = glm::min((int)(minUV.y * height), height - 1) >> level;
+		int y1 = glm::min((int)(maxUV.y * height), height - 1) >> level;
+		float maxDepth = 0.00f;
+		for (int y = y0; y <= y1; y++)
+		{
+			for (int x = x0; x <= x1; x++)
+			{
+				maxDepth = glm::max(maxDepth, levels[level][y * size.x + x]);
+			}
+		}
+		return minDepth > maxDepth; //hidden if its nearest point is behind the furthest depth in the area
+	}
+
+public:
+	static constexpr int blockSize = 8; //screen pixels per level 0 texel along each side, must match hiz_downsample.frag
+
+	OcclusionCuller(int screenWidth, int screenHeight)
+	{
+		width = (screenWidth + blockSize - 1) / blockSize;
+		height = (screenHeight + blockSize - 1) / blockSize;
+		glm::ivec2 size = glm::ivec2(width, height);
+		while (true) //down to 1x1
+		{
+			levelSizes.push_back(size);
+			levels.push_back(std::vector<float>(size.x * size.y, 1.00f));
+			if (size.x == 1 && size.y == 1)
+				break;
+			size = glm::max((size + 1) / 2, glm::ivec2(1));
+		}
+		for (int i = 0; i < numReadbacks; i++)
+		{
+			glCreateBuffers(1, &readbacks[i].buffer);
+			glNamedBufferStorage(readbacks[i].buffer, width * height * sizeof(float), nullptr, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+		}
+	}
+
+	~OcclusionCuller()
+	{
+		for (int i = 0; i < numReadbacks; i++)
+		{
+			if (readbacks[i].fence != nullptr)
+				glDeleteSync(readbacks[i].fence);
+			glDeleteBuffers(1, &readbacks[i].buffer);
+		}
+	}
+
+	//queue a copy of the downsampled depth, call with the framebuffer it was drawn into bound
+	void Capture(glm::mat4 matrix)
+	{
+		Readback& readback = readbacks[nextReadback];
+		if (readback.fence != nullptr) //never picked up, overwrite it
+			glDeleteSync(readback.fence);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, (void*)0); //into the PBO, returns straight away
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readback.matrix = matrix;
+		nextReadback = (nextReadback + 1) % numReadbacks;
+	}
+
+	//switch to the newest depth the GPU has finished copying, keeps the current pyramid if none is ready
+	//with SetWaitForNewest it waits for the newest copy instead, so the results don't depend on how fast the GPU is
+	void Update()
+	{
+		for (int i = 1; i <= numReadbacks; i++) //newest first
+		{
+			Readback& readback = readbacks[(nextReadback - i + numReadbacks) % numReadbacks];
+			if (readback.fence == nullptr)
+			{
+				if (waitForNewest) //nothing was captured last frame, older depth would make the lag vary
+					return;
+				continue;
+			}
+			GLenum status = waitForNewest ? glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) : glClientWaitSync(readback.fence, 0, 0); //up to a second, else don't wait
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			{
+				if (waitForNewest)
+					return;
+				continue;
+			}
+			void* data = glMapNamedBufferRange(readback.buffer, 0, width * height * sizeof(float), GL_MAP_READ_BIT);
+			if (data == nullptr)
+				return;
+			memcpy(levels[0].data(), data, width * height * sizeof(float));
+			glUnmapNamedBuffer(readback.buffer);
+			BuildPyramid();
+			pyramidMatrix = readback.matrix;
+			pyramidValid = true;
+			for (int j = i; j <= numReadbacks; j++) //this and anything older are used up
+			{
+				Readback& older = readbacks[(nextReadback - j + numReadbacks) % numReadbacks];
+				if (older.fence != nullptr)
+					glDeleteSync(older.fence);
+				older.fence = nullptr;
+			}
+			return;
+		}
+	}
+
+	//clears visible for every box hidden behind the pyramid's depth, only boxes that passed frustum culling are tested
+	void Cull(BoundsTable& bounds, std::vector<unsigned char>& visible)
+	{
+		tested = 0;
+		occluded = 0;
+		if (!pyramidValid)
+			return;
+		for (unsigned int slot = 0; slot < visible.size(); slot++)
+		{
+			if (visible[slot] == 0)
+				continue;
+			glm::vec3 extent = bounds.GetExtent(slot);
+			if (extent == glm::vec3(0.00f)) //unused slot
+				continue;
+			tested++;
+			if (IsOccluded(bounds.GetCenter(slot), extent))
+			{
+				visible[slot] = 0;
+				occluded++;
+			}
+		}
+	}
+
+	int GetWidth()
+	{
+		return width;
+	}
+
+	int GetHeight()
+	{
+		return height;
+	}
+
+	void SetWaitForNewest(bool wait)
+	{
+		waitForNewest = wait;
+	}
+
+	unsigned int GetTestedCount()
+	{
+		return tested;
+	}
+
+	unsigned int GetOccludedCount()
+	{
+		return occluded;
+	}
+};
+const unsigned char* cullResults = nullptr; //visibility of each bounds slot for the current pass, nullptr draws everything
+
+//what the current pass picks mesh LODs with, set alongside cullResults
+struct LodView
+{
+	glm::vec3 eye = glm::vec3(0.00f);
+	float pixelsPerUnit = 0.00f; //pixels one world unit covers at a distance of one, 0 always draws the full detail mesh
+	float maxError = 1.00f; //how many pixels a LOD's surface may be off by, bigger picks coarser LODs sooner
+	bool orthographic = false; //pixelsPerUnit is then the same at every distance, e.g. texels per unit of a shadow cascade
+};
+LodView lodView;
+
+//immutable GPU geometry shared between every instance of a mesh
+//instances only own their transform and color, so copying a Model just adds a reference here
+class MeshData
+{
+protected:
+	GLObject* renderObject;
+	Bounds bounds; //model space bounds calculated at import
+	unsigned int references = 1; //number of DrawableObjects using this data
+	std::vector<GLObject*> lods; //coarser versions of renderObject, lods[0] is LOD 1
+	std::vector<float> lodErrors; //model space error of each of lods
+
+	~MeshData()
+	{
+		delete renderObject;
+		for (unsigned long long int i = 0; i < lods.size(); i++)
+		{
+			delete lods[i];
+		}
+	}
+
+public:
+	MeshData(const MeshData&) = delete;
+	MeshData(void* attribData, unsigned int attribSize, void* indexData, unsigned int indexSize, int attribOffset = 0, bool useArena = true)
+	{
+		renderObject = new GLObject(attribData, attribSize, indexData, indexSize, attribOffset, useArena);
+		bounds = Bounds(static_cast<Vertex*>(attribData), attribSize / sizeof(Vertex));
+	}
+
+	//packs the geometry into format and the smallest index type that fits
+	MeshData(MeshGeometry& geometry, VertexFormat format, int attribOffset = 0, bool useArena = true)
+	{
+		GLenum indexType = GetIndexType((unsigned int)geometry.vertices.size());
+		std::vector<unsigned char> attribData = PackVertices(geometry.vertices, format);
+		std::vector<unsigned char> indexData = PackIndices(geometry.indices, indexType);
+		renderObject = new GLObject(attribData.data(), (unsigned int)attribData.size(), indexData.data(), (unsigned int)indexData.size(), attribOffset, useArena, format, indexType);
+		bounds = Bounds(geometry.vertices.data(), (unsigned int)geometry.vertices.size()); //from the float positions as packing can round them
+	}
+
+	MeshData(void* attribData, unsigned int attribSize, int attribOffset = 0)
+	{
+		renderObject = new GLObject(attribData, attribSize, attribOffset);
+		bounds = Bounds(static_cast<Vertex*>(attribData), attribSize / sizeof(Vertex));
+	}
+
+	MeshData* Acquire()
+	{
+		references++;
+		return this;
+	}
+
+	void Release()
+	{
+		references--;
+		if (references == 0) //if nothing uses the data anymore
+			delete this; //free the GPU buffers
 	}
 
 	void Draw()
 	{
-		glBindVertexArray(object);
-		if (indexBuffer != nullptr)
-			glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, (void*)0); //draw mode, count, typeof index, offset
-		else //if not using vertex indices
-			glDrawArrays(GL_TRIANGLES, 0, triCount); //regular draw
-		glBindVertexArray(0);
+		renderObject->Draw();
 	}
 
-	GLBuffer* GetAttribBuffer()
+	void Draw(unsigned int lod)
 	{
-		return attribBuffer;
+		if (lod == 0 || lod > lods.size())
+			renderObject->Draw();
+		else
+			lods[lod - 1]->Draw();
 	}
 
-	GLBuffer* GetIndexBuffer()
+	//lods must be added from finest to coarsest, they use the same format as the full mesh so they share its VAO
+	void AddLod(MeshLod& lod, bool useArena = true)
 	{
-		return indexBuffer;
+		GLenum indexType = GetIndexType((unsigned int)lod.geometry.vertices.size());
+		std::vector<unsigned char> attribData = PackVertices(lod.geometry.vertices, renderObject->GetVertexFormat());
+		std::vector<unsigned char> indexData = PackIndices(lod.geometry.indices, indexType);
+		lods.push_back(new GLObject(attribData.data(), (unsigned int)attribData.size(), indexData.data(), (unsigned int)indexData.size(), 0, useArena,
+			renderObject->GetVertexFormat(), indexType));
+		lodErrors.push_back(lod.error);
 	}
 
-	unsigned int GetObject()
+	//the coarsest LOD whose error covers at most lodView.maxError pixels, distance is from the eye to the nearest point of the bounds
+	unsigned int SelectLod(float scale, float distance)
 	{
-		return object;
+		if (lods.empty() || lodView.pixelsPerUnit <= 0.00f)
+			return 0;
+		distance = glm::max(distance, 0.01f);
+		unsigned int lod = 0;
+		for (unsigned int i = 0; i < lods.size(); i++)
+		{
+			float pixelsPerUnit = lodView.orthographic ? lodView.pixelsPerUnit : lodView.pixelsPerUnit / distance;
+			if (lodErrors[i] * scale * pixelsPerUnit > lodView.maxError)
+				break;
+			lod = i + 1;
+		}
+		return lod;
+	}
+
+	unsigned int GetNumLods()
+	{
+		return (unsigned int)lods.size() + 1;
+	}
+
+	GLObject* GetGLObject()
+	{
+		return renderObject;
+	}
+
+	Bounds GetBounds()
+	{
+		return bounds;
+	}
+
+	unsigned int GetReferences()
+	{
+		return references;
 	}
 };
 
@@ -865,6 +3825,130 @@ public:
 	}
 };
 
+//fixed capacity particle storage with one array per attribute so updates stream straight through memory
+//a dying particle is replaced by the last live one, so the live particles are always [0, count) and nothing is allocated after construction
+class ParticlePool
+{
+protected:
+	unsigned int capacity;
+	unsigned int count = 0;
+	std::vector<float> positionX, positionY, positionZ;
+	std::vector<float> rotationX, rotationY, rotationZ, rotationW; //quaternion
+	std::vector<float> age; //in seconds
+	std::vector<float> scale;
+	float lifeTime;
+	float startScale;
+	float endScale;
+
+	void Move(unsigned int from, unsigned int to)
+	{
+		positionX[to] = positionX[from];
+		positionY[to] = positionY[from];
+		positionZ[to] = positionZ[from];
+		rotationX[to] = rotationX[from];
+		rotationY[to] = rotationY[from];
+		rotationZ[to] = rotationZ[from];
+		rotationW[to] = rotationW[from];
+		age[to] = age[from];
+		scale[to] = scale[from];
+	}
+
+public:
+	ParticlePool(unsigned int _capacity, float _lifeTime, float _startScale, float _endScale)
+	{
+		capacity = _capacity;
+		lifeTime = _lifeTime;
+		startScale = _startScale;
+		endScale = _endScale;
+		unsigned int padded = ((capacity + 3) / 4) * 4; //whole groups of 4 so the SSE loop never needs a tail
+		std::vector<float>* arrays[] = { &positionX, &positionY, &positionZ, &rotationX, &rotationY, &rotationZ, &rotationW, &age, &scale };
+		for (std::vector<float>* array : arrays)
+		{
+			array->resize(padded, 0.00f);
+		}
+	}
+
+	//returns false if the pool is full
+	bool Spawn(glm::vec3 position, glm::quat rotation)
+	{
+		if (count == capacity)
+			return false;
+		positionX[count] = position.x;
+		positionY[count] = position.y;
+		positionZ[count] = position.z;
+		rotationX[count] = rotation.x;
+		rotationY[count] = rotation.y;
+		rotationZ[count] = rotation.z;
+		rotationW[count] = rotation.w;
+		age[count] = 0.00f;
+		scale[count] = startScale;
+		count++;
+		return true;
+	}
+
+	//age and scale every particle, then swap out the dead ones
+	void Update(float deltaTime)
+	{
+		float inverseLifeTime = 1.00f / lifeTime;
+		float scaleRange = endScale - startScale;
+		for (unsigned int i = 0; i < count; i += 4) //slots past count are padding or dead so updating them is harmless
+		{
+#ifdef USE_SSE
+			__m128 newAge = _mm_add_ps(_mm_loadu_ps(&age[i]), _mm_set1_ps(deltaTime));
+			_mm_storeu_ps(&age[i], newAge);
+			__m128 t = _mm_min_ps(_mm_mul_ps(newAge, _mm_set1_ps(inverseLifeTime)), _mm_set1_ps(1.00f));
+			_mm_storeu_ps(&scale[i], _mm_add_ps(_mm_set1_ps(startScale), _mm_mul_ps(t, _mm_set1_ps(scaleRange))));
+#else
+			for (unsigned int j = i; j < i + 4; j++)
+			{
+				age[j] += deltaTime;
+				scale[j] = startScale + glm::min(age[j] * inverseLifeTime, 1.00f) * scaleRange;
+			}
+#endif
+		}
+		unsigned int i = 0;
+		while (i < count)
+		{
+			if (age[i] >= lifeTime)
+			{
+				count--;
+				Move(count, i); //don't advance, the moved particle still needs checking
+			}
+			else
+				i++;
+		}
+	}
+
+	//model matrix of each live particle into out[0, count)
+	void WriteMatrices(glm::mat4* out)
+	{
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::mat4 matrix = glm::mat4_cast(glm::quat(rotationW[i], rotationX[i], rotationY[i], rotationZ[i]));
+			matrix[0] *= scale[i];
+			matrix[1] *= scale[i];
+			matrix[2] *= scale[i];
+			matrix[3] = glm::vec4(positionX[i], positionY[i], positionZ[i], 1.00f);
+			out[i] = matrix;
+		}
+	}
+
+	void Clear()
+	{
+		count = 0;
+	}
+
+	unsigned int GetCount()
+	{
+		return count;
+	}
+
+	unsigned int GetCapacity()
+	{
+		return capacity;
+	}
+};
+
 enum class AnimationLoopType
 {
 	loop,
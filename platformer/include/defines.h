@@ -2,13 +2,17 @@
 #define _myDefines
 
 #ifdef _WIN32
-#define exit(code) exit(##code##)
+#define exit(code) exit(code)
 #endif
 
 #define PI glm::pi<float>()
 #define DEFAULT_COLOR glm::vec3(0.899f, 0.745f, 0.369f)
+#define SCENE_LIGHT_POSITION (glm::vec3(0.5f, 1.5f, 0.5f) * 0.4f) //the fixed red point light every lit shader gets
+#define SCENE_LIGHT_COLOR glm::vec3(1.0f, 0.2f, 0.2f)
+#define SCENE_LIGHT_ATTENUATION glm::vec3(1.0f, 0.12f, 2.00f) //constant, linear, quadratic
+#define RENDER_STATS //count draws, state changes and uploads at the GL calls (see functions.h), comment out to call GL directly
 
-#define Path(asset) (std::string(SDL_GetBasePath() + std::string("assets\\") + std::string(##asset##))).c_str()
+#define Path(asset) (std::string(SDL_GetBasePath() + std::string("assets/") + std::string(asset))).c_str()
 
 #define key_Forward SDLK_W
 #define key_Left SDLK_A
@@ -18,6 +22,7 @@
 #define key_Jump SDLK_SPACE
 #define key_Sprint SDLK_LSHIFT
 #define key_Start SDLK_RETURN
+#define key_Stats SDLK_F3
 
 //create the fallback shader
 const char* errorVert = { "#version 450 core\n"
@@ -42,6 +47,7 @@ unsigned long long int eTime = 0;
 unsigned long long dTime = 1;
 unsigned long long int score = 0;
 bool isMainMenu = false;
+bool showStats = false; //draw the render stats overlay
 
 class Shader;
 Shader* errorShader = nullptr;
@@ -15,6 +15,281 @@ void PrintGLErrors()
 	}
 }
 
+//what the renderer handed to the driver, totals since startup, take the difference of two snapshots for a pass or a frame
+struct RenderStats
+{
+	unsigned long long draws = 0;
+	unsigned long long instances = 0; //1 per non instanced draw
+	unsigned long long triangles = 0; //over every instance
+	unsigned long long programSwitches = 0; //glUseProgram calls that changed the program
+	unsigned long long vertexArraySwitches = 0; //..
+	unsigned long long framebufferBinds = 0;
+	unsigned long long textureBinds = 0;
+	unsigned long long uniformBytes = 0;
+	unsigned long long bufferBytes = 0; //buffer uploads plus what was handed out of the stream buffer
+
+	void Add(const RenderStats& other)
+	{
+		draws += other.draws;
+		instances += other.instances;
+		triangles += other.triangles;
+		programSwitches += other.programSwitches;
+		vertexArraySwitches += other.vertexArraySwitches;
+		framebufferBinds += other.framebufferBinds;
+		textureBinds += other.textureBinds;
+		uniformBytes += other.uniformBytes;
+		bufferBytes += other.bufferBytes;
+	}
+
+	//the counts between start and now
+	RenderStats Since(const RenderStats& start) const
+	{
+		RenderStats result;
+		result.draws = draws - start.draws;
+		result.instances = instances - start.instances;
+		result.triangles = triangles - start.triangles;
+		result.programSwitches = programSwitches - start.programSwitches;
+		result.vertexArraySwitches = vertexArraySwitches - start.vertexArraySwitches;
+		result.framebufferBinds = framebufferBinds - start.framebufferBinds;
+		result.textureBinds = textureBinds - start.textureBinds;
+		result.uniformBytes = uniformBytes - start.uniformBytes;
+		result.bufferBytes = bufferBytes - start.bufferBytes;
+		return result;
+	}
+};
+
+RenderStats renderStats; //only counts with RENDER_STATS defined
+
+#ifdef RENDER_STATS
+//each wrapper counts then calls through, the #defines after them send every later call in the program here
+//so draws and state changes are counted wherever they come from, not only through the classes that usually make them
+glm::uint statsProgram = 0; //last program passed to glUseProgram
+
+void CountDraw(GLenum mode, int count, int instances)
+{
+	renderStats.draws++;
+	renderStats.instances += instances;
+	if (mode == GL_TRIANGLES)
+		renderStats.triangles += (unsigned long long)(count / 3) * instances;
+	else if (mode == GL_TRIANGLE_STRIP)
+		renderStats.triangles += (unsigned long long)glm::max(count - 2, 0) * instances;
+}
+
+void StatsDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	CountDraw(mode, count, 1);
+	glDrawArrays(mode, first, count);
+}
+
+void StatsDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+	CountDraw(mode, count, 1);
+	glDrawElements(mode, count, type, indices);
+}
+
+void StatsDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLint baseVertex)
+{
+	CountDraw(mode, count, 1);
+	glDrawElementsBaseVertex(mode, count, type, indices, baseVertex);
+}
+
+void StatsDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+	CountDraw(mode, count, instances);
+	glDrawArraysInstanced(mode, first, count, instances);
+}
+
+void StatsDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances)
+{
+	CountDraw(mode, count, instances);
+	glDrawElementsInstanced(mode, count, type, indices, instances);
+}
+
+void StatsDrawElementsInstancedBaseVertex(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances, GLint baseVertex)
+{
+	CountDraw(mode, count, instances);
+	glDrawElementsInstancedBaseVertex(mode, count, type, indices, instances, baseVertex);
+}
+
+void StatsUseProgram(GLuint program)
+{
+	if (program != statsProgram)
+		renderStats.programSwitches++;
+	statsProgram = program;
+	glUseProgram(program);
+}
+
+void StatsBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	renderStats.framebufferBinds++;
+	glBindFramebuffer(target, framebuffer);
+}
+
+void StatsBindTextureUnit(GLuint unit, GLuint texture)
+{
+	renderStats.textureBinds++;
+	glBindTextureUnit(unit, texture);
+}
+
+void StatsNamedBufferData(GLuint buffer, GLsizeiptr size, const void* data, GLenum usage)
+{
+	if (data != nullptr) //only allocating uploads nothing
+		renderStats.bufferBytes += size;
+	glNamedBufferData(buffer, size, data, usage);
+}
+
+void StatsNamedBufferSubData(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data)
+{
+	renderStats.bufferBytes += size;
+	glNamedBufferSubData(buffer, offset, size, data);
+}
+
+void StatsUniform1i(GLint location, GLint v0)
+{
+	renderStats.uniformBytes += sizeof(GLint);
+	glUniform1i(location, v0);
+}
+
+void StatsUniform1ui(GLint location, GLuint v0)
+{
+	renderStats.uniformBytes += sizeof(GLuint);
+	glUniform1ui(location, v0);
+}
+
+void StatsUniform1f(GLint location, GLfloat v0)
+{
+	renderStats.uniformBytes += sizeof(GLfloat);
+	glUniform1f(location, v0);
+}
+
+void StatsUniform2i(GLint location, GLint v0, GLint v1)
+{
+	renderStats.uniformBytes += sizeof(GLint) * 2;
+	glUniform2i(location, v0, v1);
+}
+
+void StatsUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+	renderStats.uniformBytes += sizeof(GLfloat) * 3;
+	glUniform3f(location, v0, v1, v2);
+}
+
+void StatsUniform3fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	renderStats.uniformBytes += sizeof(GLfloat) * 3 * count;
+	glUniform3fv(location, count, value);
+}
+
+void StatsUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	renderStats.uniformBytes += sizeof(GLfloat) * 16 * count;
+	glUniformMatrix4fv(location, count, transpose, value);
+}
+
+void StatsProgramUniform1i(GLuint program, GLint location, GLint v0)
+{
+	renderStats.uniformBytes += sizeof(GLint);
+	glProgramUniform1i(program, location, v0);
+}
+
+void StatsProgramUniform1ui(GLuint program, GLint location, GLuint v0)
+{
+	renderStats.uniformBytes += sizeof(GLuint);
+	glProgramUniform1ui(program, location, v0);
+}
+
+void StatsProgramUniform1f(GLuint program, GLint location, GLfloat v0)
+{
+	renderStats.uniformBytes += sizeof(GLfloat);
+	glProgramUniform1f(program, location, v0);
+}
+
+void StatsProgramUniform4fv(GLuint program, GLint location, GLsizei count, const GLfloat* value)
+{
+	renderStats.uniformBytes += sizeof(GLfloat) * 4 * count;
+	glProgramUniform4fv(program, location, count, value);
+}
+
+#undef glDrawElementsBaseVertex
+#undef glDrawArraysInstanced
+#undef glDrawElementsInstanced
+#undef glDrawElementsInstancedBaseVertex
+#undef glUseProgram
+#undef glBindFramebuffer
+#undef glBindTextureUnit
+#undef glNamedBufferData
+#undef glNamedBufferSubData
+#undef glUniform1i
+#undef glUniform1ui
+#undef glUniform1f
+#undef glUniform2i
+#undef glUniform3f
+#undef glUniform3fv
+#undef glUniformMatrix4fv
+#undef glProgramUniform1i
+#undef glProgramUniform1ui
+#undef glProgramUniform1f
+#undef glProgramUniform4fv
+#define glDrawArrays StatsDrawArrays
+#define glDrawElements StatsDrawElements
+#define glDrawElementsBaseVertex StatsDrawElementsBaseVertex
+#define glDrawArraysInstanced StatsDrawArraysInstanced
+#define glDrawElementsInstanced StatsDrawElementsInstanced
+#define glDrawElementsInstancedBaseVertex StatsDrawElementsInstancedBaseVertex
+#define glUseProgram StatsUseProgram
+#define glBindFramebuffer StatsBindFramebuffer
+#define glBindTextureUnit StatsBindTextureUnit
+#define glNamedBufferData StatsNamedBufferData
+#define glNamedBufferSubData StatsNamedBufferSubData
+#define glUniform1i StatsUniform1i
+#define glUniform1ui StatsUniform1ui
+#define glUniform1f StatsUniform1f
+#define glUniform2i StatsUniform2i
+#define glUniform3f StatsUniform3f
+#define glUniform3fv StatsUniform3fv
+#define glUniformMatrix4fv StatsUniformMatrix4fv
+#define glProgramUniform1i StatsProgramUniform1i
+#define glProgramUniform1ui StatsProgramUniform1ui
+#define glProgramUniform1f StatsProgramUniform1f
+#define glProgramUniform4fv StatsProgramUniform4fv
+#endif
+
+unsigned int boundVertexArray = 0; //the VAO currently bound, all VAO binds go through BindVertexArray to keep this correct
+
+void BindVertexArray(unsigned int vao)
+{
+	if (vao == boundVertexArray) //if already bound
+		return; //skip the redundant state change
+	glBindVertexArray(vao);
+	boundVertexArray = vao;
+#ifdef RENDER_STATS
+	renderStats.vertexArraySwitches++; //counted here not in a wrapper so redundant binds skipped above don't count
+#endif
+}
+
+unsigned int emptyVertexArray = 0; //attributeless VAO for full screen passes, the vertex shader makes the positions from gl_VertexID
+
+void BindEmptyVertexArray()
+{
+	if (emptyVertexArray == 0)
+		glCreateVertexArrays(1, &emptyVertexArray);
+	BindVertexArray(emptyVertexArray);
+}
+
+//draws one triangle that covers the whole screen
+void DrawFullscreenTriangle()
+{
+	BindEmptyVertexArray();
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+//draws count 4 vertex triangle strips, the vertex shader places each one from gl_InstanceID
+void DrawInstancedQuads(unsigned int count)
+{
+	BindEmptyVertexArray();
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, count);
+}
+
 class PhysicsErrorCallback : public PxErrorCallback
 {
 public:
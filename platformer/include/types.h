@@ -4,14 +4,22 @@
 #include "SDL3/SDL_opengl.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
+#include <functional>
+#include <unordered_map>
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtc/quaternion.hpp"
+#include "glm/gtc/packing.hpp"
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/vector_angle.hpp>
 #include "PhysX/PxPhysicsAPI.h"
+#if defined(_M_X64) || defined(__SSE2__)
+	#define USE_SSE
+	#include <xmmintrin.h>
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #ifdef WINDOWS
 	#define STBI_WINDOWS_UTF8 //change this have ifdef WINDOWS 
@@ -28,6 +36,7 @@ class GLFramebuffer;
 class Player;
 class StaticModel;
 class DustCloud;
+class ParticleSystem;
 class StaminaBar;
 class Texture;
 
@@ -40,11 +49,11 @@ PxPhysics* pPhysics;
 PxDefaultCpuDispatcher* pDispatcher;
 PxScene* pScene;
 PxMaterial* pMaterial;
-GLFramebuffer* depthBuffer;
 Shader* shadowShader;
 StaticModel* groundPlane;
 StaminaBar* stamBar;
 DustCloud* playerCloud;
+ParticleSystem* dustParticles;
 Texture* toggleTexture;
 Shader* toggleShader;
 
@@ -98,56 +107,161 @@ public:
 	}
 };
 
+class DrawableObject;
+std::vector<DrawableObject*> dirtyBounds; //drawables whose world bounds need recalculating before the next cull
+
 class DrawableObject : public Object
 {
 protected:
-	GLObject* renderObject;
+	MeshData* meshData;
 	glm::mat4 model;
 	glm::vec3 color = DEFAULT_COLOR;
+	unsigned int boundsSlot = noBoundsSlot; //our slot in worldBounds
+	bool boundsDirty = false;
+
+	void RegisterBounds()
+	{
+		if (meshData == nullptr)
+			return;
+		boundsSlot = worldBounds.Register();
+		MarkBoundsDirty();
+	}
+
+	void MarkBoundsDirty()
+	{
+		if (boundsDirty || boundsSlot == noBoundsSlot) //if already queued or has nothing to cull
+			return;
+		boundsDirty = true;
+		dirtyBounds.push_back(this);
+	}
 
 public:
+	bool IsCulled()
+	{
+		return cullResults != nullptr && boundsSlot != noBoundsSlot && boundsSlot < worldBounds.GetCapacity() && cullResults[boundsSlot] == 0;
+	}
+
 	DrawableObject(glm::vec3 pos, glm::vec3 _rot, glm::vec3 scale, void* attribData, unsigned int attribSize, void* indexData, unsigned int indexSize)
 		:Object(pos, _rot, scale) {
-		renderObject = new GLObject(attribData, attribSize, indexData, indexSize);
+		meshData = new MeshData(attribData, attribSize, indexData, indexSize);
+		RegisterBounds();
 	}
 
 	DrawableObject(glm::vec3 pos, glm::vec3 _rot, glm::vec3 scale, void* attribData, unsigned int attribSize)
 		:Object(pos, _rot, scale) {
-		renderObject = new GLObject(attribData, attribSize);
+		meshData = new MeshData(attribData, attribSize);
+		RegisterBounds();
 	}
 
 	DrawableObject(glm::vec3 pos, glm::quat _rot, glm::vec3 scale, void* attribData, unsigned int attribSize, void* indexData, unsigned int indexSize)
 		:Object(pos, _rot, scale) {
-		renderObject = new GLObject(attribData, attribSize, indexData, indexSize);
+		meshData = new MeshData(attribData, attribSize, indexData, indexSize);
+		RegisterBounds();
 	}
 
 	DrawableObject(glm::vec3 pos, glm::quat _rot, glm::vec3 scale, void* attribData, unsigned int attribSize)
 		:Object(pos, _rot, scale) {
-		renderObject = new GLObject(attribData, attribSize);
+		meshData = new MeshData(attribData, attribSize);
+		RegisterBounds();
 	}
 
 	DrawableObject(const DrawableObject& other)
 	{
-		renderObject = new GLObject(*other.renderObject);
+		meshData = nullptr;
+		if (other.meshData != nullptr)
+			meshData = other.meshData->Acquire(); //share the GPU data instead of copying it
 		color = other.color;
 		pos = other.pos;
 		rot = other.rot;
 		scal = other.scal;
+		RegisterBounds();
 	}
 
+	DrawableObject& operator=(const DrawableObject&) = delete; //would leak our bounds slot and mesh reference, copy construct instead
+
 	DrawableObject()
 	{
-		renderObject = nullptr;
+		meshData = nullptr;
+	}
+
+	~DrawableObject()
+	{
+		if (boundsDirty) //make sure UpdateDirtyBounds doesn't touch us after we are gone
+			dirtyBounds.erase(std::find(dirtyBounds.begin(), dirtyBounds.end(), this));
+		if (boundsSlot != noBoundsSlot)
+			worldBounds.Unregister(boundsSlot);
+		if (meshData != nullptr)
+			meshData->Release(); //frees the GPU data if we were the last user
 	}
 
-	void InitializeRenderObject(void* attribData, unsigned int attribSize, void* indexData, unsigned int indexSize, int attribOffset = 0)
+	void InitializeRenderObject(void* attribData, unsigned int attribSize, void* indexData, unsigned int indexSize, int attribOffset = 0, bool useArena = true)
 	{
-		renderObject = new GLObject(attribData, attribSize, indexData, indexSize, attribOffset);
+		meshData = new MeshData(attribData, attribSize, indexData, indexSize, attribOffset, useArena);
+		RegisterBounds();
+	}
+
+	void InitializeRenderObject(MeshGeometry& geometry, VertexFormat format, bool useArena = true)
+	{
+		meshData = new MeshData(geometry, format, 0, useArena);
+		RegisterBounds();
 	}
 
 	void InitializeRenderObject(void* attribData, unsigned int attribSize, int attribOffset = 0)
 	{
-		renderObject = new GLObject(attribData, attribSize, attribOffset);
+		meshData = new MeshData(attribData, attribSize, attribOffset);
+		RegisterBounds();
+	}
+
+	//transform the model space box into a world space box that encloses it
+	void UpdateWorldBounds()
+	{
+		boundsDirty = false;
+		Bounds bounds = meshData->GetBounds();
+		glm::mat4 matrix = CalculateModel();
+		glm::vec3 center = matrix * glm::vec4(bounds.GetCenter(), 1.00f);
+		glm::vec3 extent = bounds.GetExtent();
+		glm::vec3 worldExtent = glm::vec3(0.00f);
+		for (int i = 0; i < 3; i++) //sum the extents projected onto each world axis
+		{
+			worldExtent[i] = glm::abs(matrix[0][i]) * extent.x + glm::abs(matrix[1][i]) * extent.y + glm::abs(matrix[2][i]) * extent.z;
+		}
+		worldBounds.Set(boundsSlot, center, worldExtent);
+	}
+
+	void Move(glm::vec3 amt)
+	{
+		Object::Move(amt);
+		MarkBoundsDirty();
+	}
+
+	void Scale(glm::vec3 amt)
+	{
+		Object::Scale(amt);
+		MarkBoundsDirty();
+	}
+
+	void Rotate(glm::quat _quat)
+	{
+		Object::Rotate(_quat);
+		MarkBoundsDirty();
+	}
+
+	void SetPosition(glm::vec3 val)
+	{
+		Object::SetPosition(val);
+		MarkBoundsDirty();
+	}
+
+	void SetRotation(glm::quat val)
+	{
+		Object::SetRotation(val);
+		MarkBoundsDirty();
+	}
+
+	void SetScale(glm::vec3 val)
+	{
+		Object::SetScale(val);
+		MarkBoundsDirty();
 	}
 
 	glm::mat4 CalculateModel()
@@ -160,34 +274,197 @@ public:
 
 	virtual void Draw()
 	{
+		if (IsCulled()) //if outside the current pass's view
+			return;
 		model = CalculateModel(); //get updated model mat
 		unsigned int currentProgram = 0; //init
 		glGetIntegerv(GL_CURRENT_PROGRAM, reinterpret_cast<int*>(&currentProgram)); //get currently active program
 		glUniformMatrix4fv(glGetUniformLocation(currentProgram, "model"), 1, false, glm::value_ptr(model)); //set that program's model uniform to our model mat
 		glUniform3fv(glGetUniformLocation(currentProgram, "baseColor"), 1, glm::value_ptr(color)); //set the color in the shader
-		renderObject->Draw(); //draw
+		meshData->Draw(SelectLod()); //draw
 	}
 
 	virtual void Draw(Shader* shader)
 	{
 		shader->Use(); //make sure the passed shader is active
+		if (IsCulled())
+			return;
+		Submit(shader);
+	}
+
+	//set our uniforms and draw, shader must already be active
+	void Submit(Shader* shader)
+	{
+		SetDrawUniforms(shader);
+		meshData->Draw(SelectLod()); //draw
+	}
+
+	//draw blended towards next (the same mesh in the next frame of an animation), shader must already be active with animFac set to animFac
+	void DrawMorph(Shader* shader, DrawableObject* next, int animFacLocation, float animFac)
+	{
+		if (IsCulled())
+			return;
+		SetDrawUniforms(shader);
+		meshData->GetGLObject()->DrawMorph(next->GetGLObject(), animFacLocation, animFac);
+	}
+
+	void SetDrawUniforms(Shader* shader)
+	{
 		model = CalculateModel(); //get the updated model matrix
 		glUniformMatrix4fv(glGetUniformLocation(shader->GetProgram(), "model"), 1, false, glm::value_ptr(model)); //update the uniform in the shader to new matrix
 		glUniform3fv(glGetUniformLocation(shader->GetProgram(), "baseColor"), 1, glm::value_ptr(color)); //set the color in the shader
-		renderObject->Draw(); //draw
+	}
+
+	//pick the LOD for the current pass's lodView, model must be up to date
+	unsigned int SelectLod()
+	{
+		if (meshData->GetNumLods() == 1)
+			return 0;
+		Bounds bounds = meshData->GetBounds();
+		float scale = glm::max(scal.x, glm::max(scal.y, scal.z));
+		glm::vec3 center = model * glm::vec4(bounds.sphereCenter, 1.00f);
+		return meshData->SelectLod(scale, glm::length(center - lodView.eye) - bounds.sphereRadius * scale);
 	}
 
 	GLObject* GetGLObject()
 	{
-		return renderObject;
+		return meshData->GetGLObject();
+	}
+
+	MeshData* GetMeshData()
+	{
+		return meshData;
 	}
 
 	void SetColor(glm::vec3 _color)
 	{
 		color = _color;
 	}
+
+	glm::vec3 GetColor()
+	{
+		return color;
+	}
+};
+
+//recalculate the world bounds of everything that moved since the last cull
+void UpdateDirtyBounds()
+{
+	std::for_each(dirtyBounds.begin(), dirtyBounds.end(), [&](DrawableObject* drawable) { drawable->UpdateWorldBounds(); });
+	dirtyBounds.clear();
+}
+
+//draws queued for one pass, sorted so draws sharing a program, VAO and color are submitted together
+//key layout from the top bit down: layer (4) | program (12) | VAO (12) | material (16) | depth (20)
+class RenderQueue
+{
+protected:
+	struct RenderItem
+	{
+		unsigned long long key;
+		DrawableObject* drawable;
+		Shader* shader;
+	};
+
+	struct SortEntry
+	{
+		unsigned long long key;
+		unsigned int index;
+	};
+
+	std::vector<RenderItem> items;
+	std::vector<SortEntry> entries;
+	std::vector<SortEntry> scratch;
+	glm::vec3 viewPosition = glm::vec3(0.00f);
+	float maxDepth = 64.00f; //distances past this all get the furthest depth bucket
+
+	static unsigned long long PackColor(glm::vec3 color)
+	{
+		glm::vec3 c = glm::clamp(color, glm::vec3(0.00f), glm::vec3(1.00f));
+		return ((unsigned long long)(c.r * 31.00f) << 11) | ((unsigned long long)(c.g * 63.00f) << 5) | (unsigned long long)(c.b * 31.00f); //rgb565
+	}
+
+	//LSD radix sort on the keys, 8 bits per pass, bytes that are the same for every key are skipped
+	void Sort()
+	{
+		unsigned int count = (unsigned int)items.size();
+		entries.resize(count);
+		scratch.resize(count);
+		unsigned int histograms[8][256] = {};
+		for (unsigned int i = 0; i < count; i++) //build every histogram in one sweep
+		{
+			entries[i] = SortEntry{ items[i].key, i };
+			for (int byte = 0; byte < 8; byte++)
+				histograms[byte][(items[i].key >> (byte * 8)) & 0xFF]++;
+		}
+		for (int byte = 0; byte < 8; byte++)
+		{
+			unsigned int* histogram = histograms[byte];
+			if (histogram[(entries[0].key >> (byte * 8)) & 0xFF] == count) //every key has the same byte so this pass would do nothing
+				continue;
+			unsigned int offset = 0;
+			for (int bucket = 0; bucket < 256; bucket++) //turn counts into start offsets
+			{
+				unsigned int bucketCount = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucketCount;
+			}
+			for (unsigned int i = 0; i < count; i++) //stable scatter
+				scratch[histogram[(entries[i].key >> (byte * 8)) & 0xFF]++] = entries[i];
+			entries.swap(scratch);
+		}
+	}
+
+public:
+	//layer is the most significant part of the key so lower layers are always drawn first
+	void Push(DrawableObject* drawable, Shader* shader, unsigned int layer = 0)
+	{
+		if (drawable == nullptr || drawable->IsCulled()) //nothing to draw
+			return;
+		unsigned long long program = shader->GetProgram() & 0xFFF;
+		unsigned long long vao = drawable->GetGLObject()->GetDrawVertexArray() & 0xFFF;
+		unsigned long long material = PackColor(drawable->GetColor());
+		float distance = glm::clamp(glm::length(drawable->GetPosition() - viewPosition) / maxDepth, 0.00f, 1.00f);
+		unsigned long long depth = (unsigned long long)(distance * 0xFFFFF); //front to back
+		unsigned long long key = ((unsigned long long)(layer & 0xF) << 60) | (program << 48) | (vao << 36) | (material << 20) | depth;
+		items.push_back(RenderItem{ key, drawable, shader });
+	}
+
+	//start a new pass, depth in the key is measured from viewPos
+	void Begin(glm::vec3 viewPos)
+	{
+		items.clear();
+		viewPosition = viewPos;
+	}
+
+	//sort and draw everything queued, uniforms shared by the whole pass must already be set on each shader
+	void Flush()
+	{
+		if (items.empty())
+			return;
+		Sort();
+		Shader* currentShader = nullptr;
+		for (unsigned long long int i = 0; i < entries.size(); i++)
+		{
+			RenderItem& item = items[entries[i].index];
+			if (item.shader != currentShader) //only switch programs when the sorted order changes shader
+			{
+				item.shader->Use();
+				currentShader = item.shader;
+			}
+			item.drawable->Submit(item.shader);
+		}
+		items.clear();
+	}
+
+	unsigned long long int GetCount()
+	{
+		return items.size();
+	}
 };
 
+RenderQueue renderQueue;
+
 class Mesh: public DrawableObject
 {
 protected:
@@ -196,68 +473,57 @@ protected:
 	glm::quat parentRotation;
 	glm::vec3 parentScale;
 
-public:
-	Mesh(aiMesh* mesh, aiMaterial* material, aiMatrix4x4 globalTransform)
+	void Initialize(MeshGeometry& geometry, aiMatrix4x4 globalTransform, bool useArena, VertexFormat format, bool optimize, LodGrid* lodGrid = nullptr)
 	{
+		if (optimize)
+			importStats.Add(OptimizeMeshGeometry(geometry));
+		std::vector<MeshLod> lods;
+		if (optimize) //LODs reorder vertices too so only optimized meshes get them
+		{
+			LodGrid ownGrid;
+			lods = GenerateLods(geometry, 3, lodGrid != nullptr ? *lodGrid : ownGrid);
+		}
 		aiVector3f globalPos;
 		aiQuaternion globalRot;
 		aiVector3f globalScale;
 		globalTransform.Decompose(globalScale, globalRot, globalPos); //get pos rot and scal from the globalTransform
-		unsigned int numVerts = mesh->mNumVertices;
-		if (numVerts > 0) //if it has some verts
+		//init the DrawableObject
+		DrawableObject::InitializeRenderObject(geometry, format, useArena);
+		for (unsigned long long int i = 0; i < lods.size(); i++)
 		{
-			Vertex* vertices = new Vertex[numVerts]; //alloc
-			for (unsigned int vert = 0; vert < numVerts; vert++) //loop over each vert
-			{
-				Vertex vertex = Vertex{ FromAssimpVec(mesh->mVertices[vert]),
-					FromAssimpVec(mesh->mNormals[vert]),
-					glm::vec2(mesh->mTextureCoords[0][vert].x, mesh->mTextureCoords[0][vert].y) }; //extract and store the info in a Vertex struct
-				vertices[vert] = vertex; //store on the mesh
-			}
-			unsigned int numFaces = mesh->mNumFaces; //get number of faces
-			unsigned int* faces = new unsigned int[numFaces * 3]; //3 indices per face
-			for (unsigned int face = 0; face < numFaces; face++) //loop over faces
-			{
-				aiFace currFace = mesh->mFaces[face];
-				if (currFace.mNumIndices == 3) //make sure its a triangle
-				{
-					faces[face * 3] = currFace.mIndices[0]; //set each index
-					faces[face * 3 + 1] = currFace.mIndices[1];
-					faces[face * 3 + 2] = currFace.mIndices[2];
-				}
-				else
-				{
-					delete[] faces;
-					std::cout << "Error: Failed to create mesh indices!: Face not a triangle! \n";
-					return; //fail not a triangle
-				}
-			}
-			if (material != nullptr) //if we have a material
-			{
-				aiColor3D diffuseCol;
-				material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseCol); //get the diffuse color from the material
-				color = glm::vec3(diffuseCol.r, diffuseCol.g, diffuseCol.b); //set the shader baseColor to diffuse color
-			}
-			//init the DrawableObject
-			DrawableObject::InitializeRenderObject(vertices, numVerts * sizeof(Vertex), faces, numFaces * 3 * sizeof(unsigned int));
-			//init the drawable object pos rot scale
-			parentPosition = FromAssimpVec(globalPos);
-			parentRotation = FromAssimpQuat(globalRot);
-			//parentRotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
-			parentScale = FromAssimpVec(globalScale);
-			DrawableObject::SetPosition(parentPosition); //set position from matrix
-			DrawableObject::SetRotation(parentRotation); //set rotation from matrix
-			DrawableObject::SetScale(parentScale); //set scale from matrix
-
-			delete[] vertices; //cleanup
-			delete[] faces; //cleanup
-			complete = true;
+			meshData->AddLod(lods[i], useArena);
 		}
-		else
+		//init the drawable object pos rot scale
+		parentPosition = FromAssimpVec(globalPos);
+		parentRotation = FromAssimpQuat(globalRot);
+		parentScale = FromAssimpVec(globalScale);
+		DrawableObject::SetPosition(parentPosition); //set position from matrix
+		DrawableObject::SetRotation(parentRotation); //set rotation from matrix
+		DrawableObject::SetScale(parentScale); //set scale from matrix
+		complete = true;
+	}
+
+public:
+	Mesh(aiMesh* mesh, aiMaterial* material, aiMatrix4x4 globalTransform, bool useArena = true, VertexFormat format = VertexFormat::packed, bool optimize = true)
+	{
+		MeshGeometry geometry;
+		if (!LoadMeshGeometry(mesh, geometry)) //extract the verts and faces
+			return; //fail
+		if (material != nullptr) //if we have a material
 		{
-			std::cout << "Error: Failed to create mesh! No vertices!\n";
-			return; //fail (no verts)
+			aiColor3D diffuseCol;
+			material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseCol); //get the diffuse color from the material
+			color = glm::vec3(diffuseCol.r, diffuseCol.g, diffuseCol.b); //set the shader baseColor to diffuse color
 		}
+		Initialize(geometry, globalTransform, useArena, format, optimize);
+	}
+
+	//create a mesh from already extracted geometry (eg a cluster of a bigger mesh), clusters pass their parent's lodGrid
+	Mesh(MeshGeometry& geometry, glm::vec3 _color, aiMatrix4x4 globalTransform, bool useArena = true, VertexFormat format = VertexFormat::packed, bool optimize = true,
+		LodGrid* lodGrid = nullptr)
+	{
+		color = _color;
+		Initialize(geometry, globalTransform, useArena, format, optimize, lodGrid);
 	}
 
 	Mesh(aiMesh* mesh, aiMaterial* material, aiMatrix4x4 globalTransform, int attributeOffset)
@@ -339,17 +605,17 @@ public:
 
 	void SetPosition(glm::vec3 position)
 	{
-		Object::SetPosition(position + parentPosition);
+		DrawableObject::SetPosition(position + parentPosition);
 	}
 
 	void SetRotation(glm::quat rotation)
 	{
-		Object::SetRotation(rotation * parentRotation);
+		DrawableObject::SetRotation(rotation * parentRotation);
 	}
 
 	void SetScale(glm::vec3 scale)
 	{
-		Object::SetScale(scale * parentScale);
+		DrawableObject::SetScale(scale * parentScale);
 	}
 };
 
@@ -358,11 +624,44 @@ class Model: public Object
 protected:
 	Mesh** meshes = nullptr;
 	unsigned int numMeshes = 0;
+	bool useArena = true; //if false our meshes get their own buffers and VAOs
+	unsigned int maxClusterTriangles = 0; //meshes with more triangles than this are split into clusters, 0 disables splitting
+	VertexFormat vertexFormat = VertexFormat::packed; //GPU layout of our meshes, every frame of an animation must use the same one
+	bool optimizeMeshes = true; //reorder and weld vertices and build LODs at import, animation frames can't as their vertices have to stay in step
+	std::vector<Mesh*> clusters; //meshes created by splitting, only used while loading
+
+	void LoadClusters(aiMesh* mesh, aiMaterial* material, aiMatrix4x4 transform)
+	{
+		MeshGeometry geometry;
+		if (!LoadMeshGeometry(mesh, geometry))
+			return;
+		glm::vec3 color = DEFAULT_COLOR;
+		if (material != nullptr) //if we have a material
+		{
+			aiColor3D diffuseCol;
+			material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseCol); //get the diffuse color from the material
+			color = glm::vec3(diffuseCol.r, diffuseCol.g, diffuseCol.b);
+		}
+		std::vector<MeshGeometry> meshClusters = SplitIntoClusters(geometry, maxClusterTriangles);
+		LodGrid lodGrid; //one grid and fixed borders for every cluster, else each picks its own cells and LOD and the seams crack
+		lodGrid.size = GetLongestSide(geometry.vertices, lodGrid.origin);
+		lodGrid.lockedPositions = FindClusterBorders(meshClusters);
+		for (unsigned long long int i = 0; i < meshClusters.size(); i++) //create a Mesh for each cluster so it gets its own bounds
+		{
+			clusters.push_back(new Mesh(meshClusters[i], color, transform, useArena, vertexFormat, optimizeMeshes, &lodGrid));
+		}
+	}
 
 public:
 	Model(const Model&) = delete;
-	Model(const char* path, glm::vec3 _pos = glm::vec3(0.f), glm::quat _rot = glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3 _scale = glm::vec3(1.f))
-	{
+	//_maxClusterTriangles splits big meshes into spatial clusters for culling, only use it for static models as it changes the mesh count
+	Model(const char* path, glm::vec3 _pos = glm::vec3(0.f), glm::quat _rot = glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3 _scale = glm::vec3(1.f), bool _useArena = true,
+		unsigned int _maxClusterTriangles = 0, VertexFormat _vertexFormat = VertexFormat::packed, bool _optimizeMeshes = true)
+	{
+		useArena = _useArena;
+		maxClusterTriangles = _maxClusterTriangles;
+		vertexFormat = _vertexFormat;
+		optimizeMeshes = _optimizeMeshes;
 		Assimp::Importer importer;
 		const aiScene* scene = importer.ReadFile(path,
 			aiProcess_CalcTangentSpace | aiProcess_Triangulate | aiProcess_GenSmoothNormals); //load scene
@@ -382,7 +681,7 @@ public:
 			numMeshes = scene->mNumMeshes; //get num of scene meshes
 			if (numMeshes > 0) //if there are some meshes in the scene
 			{
-				meshes = new Mesh* [numMeshes]; //allocate
+				meshes = new Mesh* [numMeshes](); //allocate (zeroed so we know which are loaded)
 			}
 			else
 			{
@@ -390,7 +689,26 @@ public:
 				return; //fail no meshes
 			}
 
+			importStats = MeshOptimizeStats();
 			TraverseNode(node, scene, node->mTransformation); //start processing the scene
+			if (importStats.triangles > 0)
+			{
+				std::cout << "Optimized " << path << ": " << importStats.verticesBefore << " -> " << importStats.verticesAfter << " vertices, ACMR "
+					<< importStats.GetACMRBefore() << " -> " << importStats.GetACMRAfter() << "\n";
+			}
+			if (!clusters.empty()) //if we split some meshes, replace them with their clusters
+			{
+				for (unsigned int i = 0; i < numMeshes; i++)
+				{
+					if (meshes[i] != nullptr)
+						clusters.push_back(meshes[i]);
+				}
+				delete[] meshes;
+				numMeshes = (unsigned int)clusters.size();
+				meshes = new Mesh* [numMeshes];
+				std::copy(clusters.begin(), clusters.end(), meshes);
+				clusters.clear();
+			}
 			Model::SetScale(_scale); //apply inital pos rot scale
 			Model::SetRotation(_rot);
 			Model::SetPosition(_pos);
@@ -404,6 +722,8 @@ public:
 
 	Model(Model& other, glm::vec3 _pos = glm::vec3(0.f), glm::quat _rot = glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3 _scale = glm::vec3(1.f)) {
 		numMeshes = other.numMeshes;
+		useArena = other.useArena;
+		vertexFormat = other.vertexFormat;
 		meshes = new Mesh* [numMeshes];
 		for (unsigned int i = 0; i < numMeshes; i++)
 		{
@@ -433,8 +753,14 @@ public:
 		//process node
 		for (unsigned int meshNum = 0; meshNum < node->mNumMeshes; meshNum++) //loop over meshes on node
 		{
-			if (meshes[node->mMeshes[meshNum]] != nullptr && scene->mMaterials != nullptr) //if we didn't already load this mesh
-				meshes[node->mMeshes[meshNum]] = new Mesh(scene->mMeshes[node->mMeshes[meshNum]], scene->mMaterials[scene->mMeshes[node->mMeshes[meshNum]]->mMaterialIndex], transform); //create a Mesh from the aiMesh and store it
+			aiMesh* mesh = scene->mMeshes[node->mMeshes[meshNum]];
+			if (maxClusterTriangles > 0 && mesh->mNumFaces > maxClusterTriangles && scene->mMaterials != nullptr) //if the mesh is big enough to split
+			{
+				LoadClusters(mesh, scene->mMaterials[mesh->mMaterialIndex], transform);
+				continue;
+			}
+			if (meshes[node->mMeshes[meshNum]] == nullptr && scene->mMaterials != nullptr) //if we didn't already load this mesh
+				meshes[node->mMeshes[meshNum]] = new Mesh(scene->mMeshes[node->mMeshes[meshNum]], scene->mMaterials[scene->mMeshes[node->mMeshes[meshNum]]->mMaterialIndex], transform, useArena, vertexFormat, optimizeMeshes); //create a Mesh from the aiMesh and store it
 		}
 
 		//traverse children
@@ -477,6 +803,24 @@ public:
 		}
 	}
 
+	//add our meshes to the queue instead of drawing them now
+	void Queue(RenderQueue& queue, Shader* shader, unsigned int layer = 0)
+	{
+		if (meshes != nullptr)
+		{
+			for (unsigned int i = 0; i < numMeshes; i++)
+			{
+				queue.Push(meshes[i], shader, layer);
+			}
+		}
+	}
+
+	//true if this model can move this frame, static ones can be drawn into cached shadow maps
+	virtual bool IsDynamic()
+	{
+		return false;
+	}
+
 	Mesh** GetMeshes()
 	{
 		return meshes;
@@ -791,8 +1135,13 @@ public:
 	void Update() override
 	{
 		PhysicsObject::Update();
-		Model::SetPosition(Object::pos);
-		Model::SetRotation(Object::rot);
+		Model::SetPosition(PhysicsObject::pos);
+		Model::SetRotation(PhysicsObject::rot);
+	}
+
+	bool IsDynamic() override
+	{
+		return pBody->getScene() != nullptr && !pBody->isSleeping(); //sleeping bodies can't move until something wakes them
 	}
 };
 
@@ -828,7 +1177,7 @@ public:
 		frames = new Model * [numFrames];
 		for (unsigned int i = 0; i < numFrames; i++) //loop over meshes
 		{
-			Model* frame = new Model(paths[i].c_str(), _pos, _rot, _scale); //create new model for each frame
+			Model* frame = new Model(paths[i].c_str(), _pos, _rot, _scale, true, 0, VertexFormat::packed, false); //create new model for each frame, they must share a format to blend
 			frames[i] = frame;
 		}
 		float factorFrames[2] = { 0.0f, 1.0f };
@@ -847,13 +1196,12 @@ public:
 
 	virtual void Draw(Shader* shader)
 	{
-		glUniform1f(glGetUniformLocation(shader->GetProgram(), "animFac"), factor->GetFrame());
+		int animFacLocation = glGetUniformLocation(shader->GetProgram(), "animFac");
+		float animFac = factor->GetFrame();
+		glUniform1f(animFacLocation, animFac);
 		for (unsigned int i = 0; i < frames[currentFrame]->GetNumMeshes(); i++) //loop over each mesh
 		{
-			//pass in the next frames verts so the shader can blend them
-			glBindVertexArray(frames[currentFrame]->GetMeshes()[i]->GetGLObject()->GetObject());
-			frames[currentFrame]->GetMeshes()[i]->GetGLObject()->SetupAttributes(2, frames[nextFrame]->GetMeshes()[i]->GetGLObject()->GetAttribBuffer()->GetBuffer());
-			frames[currentFrame]->GetMeshes()[i]->Draw();
+			frames[currentFrame]->GetMeshes()[i]->DrawMorph(shader, frames[nextFrame]->GetMeshes()[i], animFacLocation, animFac); //the shader blends towards the next frame's verts
 		}
 	}
 
@@ -968,7 +1316,7 @@ public:
 		frames = new Model* [numFrames];
 		for (unsigned int i = 0; i < numFrames; i++) //loop over meshes
 		{
-			frames[i] = new Model(paths[i].c_str(), _pos, _rot, _scale); //create new model for each frame
+			frames[i] = new Model(paths[i].c_str(), _pos, _rot, _scale, true, 0, VertexFormat::packed, false); //create new model for each frame, they must share a format to blend
 		}
 		float factorFrames[2] = { 0.0f, 1.0f };
 		factor = new Animation<float>(factorFrames, 2, 0.3f);
@@ -986,13 +1334,12 @@ public:
 
 	void Draw(Shader* shader)
 	{
-		glUniform1f(glGetUniformLocation(shader->GetProgram(), "animFac"), factor->GetFrame());
+		int animFacLocation = glGetUniformLocation(shader->GetProgram(), "animFac");
+		float animFac = factor->GetFrame();
+		glUniform1f(animFacLocation, animFac);
 		for (unsigned int i = 0; i < frames[currentFrame]->GetNumMeshes(); i++) //loop over each mesh
 		{
-			//pass in the next frames attributes so the shader can blend between them
-			glBindVertexArray(frames[currentFrame]->GetMeshes()[i]->GetGLObject()->GetObject());
-			frames[currentFrame]->GetMeshes()[i]->GetGLObject()->SetupAttributes(2, frames[nextFrame]->GetMeshes()[i]->GetGLObject()->GetAttribBuffer()->GetBuffer());
-			frames[currentFrame]->GetMeshes()[i]->Draw();
+			frames[currentFrame]->GetMeshes()[i]->DrawMorph(shader, frames[nextFrame]->GetMeshes()[i], animFacLocation, animFac); //the shader blends towards the next frame's verts
 		}
 	}
 
@@ -1433,105 +1780,263 @@ class Light : public Object
 {
 };
 
-class DustParticle: public Model
+class ParticleSystem;
+
+//something that spawns particles into a ParticleSystem, the system updates every emitter added to it
+class ParticleEmitter : public Object
 {
 protected:
-	Animation<glm::vec3>* anim;
-	bool dead = false;
+	ParticleSystem* system;
 
 public:
-	DustParticle(Model* copyModel, glm::vec3 position, glm::vec3 initalScale, glm::vec3 finalScale)
-		:Model(*copyModel, position, glm::quat(1.00f, 0.00f, 0.00f, 0.00f), initalScale)
+	ParticleEmitter(ParticleSystem* _system);
+	virtual ~ParticleEmitter();
+
+	virtual void Update() = 0;
+
+	unsigned int GetLiveCount(); //live particles in our system
+};
+
+//particles that share a model, lifetime and scale curve, every live particle is drawn with one instanced draw
+//on the GPU they live in a fixed size ring in one SoA buffer and spawning, aging and the scale animation run in particles.comp
+//without compute shaders they live in a ParticlePool and only the matrices are uploaded
+class ParticleSystem
+{
+public:
+	static constexpr unsigned int maxSpawnsPerUpdate = 64; //must match MAX_SPAWNS in particles.comp
+
+protected:
+	Model* model; //every particle draws this model's meshes
+	unsigned int capacity;
+	float lifeTime; //in seconds
+	float startScale;
+	float endScale;
+	glm::uint buffer = 0; //capacity positions (xyz + spawn time), then capacity rotations, then capacity model matrices
+	ComputeShader* simulateShader = nullptr; //nullptr when simulating on the CPU
+	std::vector<ParticleEmitter*> emitters;
+	std::vector<float> spawnTimes; //so the CPU knows when the oldest particle dies
+	std::vector<glm::vec4> pendingPositions; //emitted since the last Update
+	std::vector<glm::vec4> pendingRotations;
+	unsigned int head = 0; //next slot to spawn into
+	unsigned int liveCount = 0; //every particle has the same lifetime so the live ones are the liveCount slots before head
+	float lastUpdateTime = 0.00f;
+	ParticlePool* pool = nullptr; //CPU simulation only
+	StreamAllocation cpuModels; //this frame's matrices in frameStream, CPU simulation only
+
+	unsigned int GetRotationsOffset()
 	{
-		constexpr float lifeTime = 0.67f;
-		Rotate(glm::quat(glm::vec3(SDL_randf() * PI, SDL_randf() * PI, SDL_randf() * PI))); //give random inital rotation
-		glm::vec3 frames[] = { initalScale, finalScale };
-		anim = new Animation(frames, 2, lifeTime); //create animation to smoothly scale the particle
-		anim->Start();
+		return capacity * sizeof(glm::vec4);
 	}
 
-	~DustParticle()
+	unsigned int GetModelsOffset()
 	{
-		delete anim;
+		return capacity * sizeof(glm::vec4) * 2;
 	}
 
-	void Update()
+	void SimulateGPU(float time, unsigned int spawnStart, unsigned int spawnCount)
 	{
-		SetScale(anim->GetFrame());
-		if (!anim->IsPlaying()) //if anim is finished
+		glm::uint program = simulateShader->GetProgram();
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, buffer, 0, capacity * sizeof(glm::vec4));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, buffer, GetRotationsOffset(), capacity * sizeof(glm::vec4));
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, buffer, GetModelsOffset(), capacity * sizeof(glm::mat4));
+		glProgramUniform1ui(program, glGetUniformLocation(program, "capacity"), capacity);
+		glProgramUniform1ui(program, glGetUniformLocation(program, "firstParticle"), GetFirstParticle());
+		glProgramUniform1ui(program, glGetUniformLocation(program, "liveCount"), liveCount);
+		glProgramUniform1ui(program, glGetUniformLocation(program, "spawnStart"), spawnStart);
+		glProgramUniform1ui(program, glGetUniformLocation(program, "spawnCount"), spawnCount);
+		if (spawnCount > 0)
 		{
-			dead = true;
+			glProgramUniform4fv(program, glGetUniformLocation(program, "spawnPositions"), spawnCount, glm::value_ptr(pendingPositions[0]));
+			glProgramUniform4fv(program, glGetUniformLocation(program, "spawnRotations"), spawnCount, glm::value_ptr(pendingRotations[0]));
 		}
+		glProgramUniform1f(program, glGetUniformLocation(program, "time"), time);
+		glProgramUniform1f(program, glGetUniformLocation(program, "lifeTime"), lifeTime);
+		glProgramUniform1f(program, glGetUniformLocation(program, "startScale"), startScale);
+		glProgramUniform1f(program, glGetUniformLocation(program, "endScale"), endScale);
+		simulateShader->Dispatch((liveCount + 63) / 64);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT); //the draws read the matrices
 	}
 
-	bool Dead()
+	//the pool keeps the live particles packed at the front so their matrices are written straight into frameStream in one go
+	void SimulateCPU(float deltaTime)
 	{
-		return dead;
+		pool->Update(deltaTime); //before spawning, the new particles were emitted now so they start at age 0 like on the GPU path
+		for (unsigned int i = 0; i < pendingPositions.size(); i++)
+		{
+			glm::vec4 rotation = pendingRotations[i];
+			if (!pool->Spawn(glm::vec3(pendingPositions[i]), glm::quat(rotation.w, rotation.x, rotation.y, rotation.z))) //if full drop the rest
+				break;
+		}
+		liveCount = pool->GetCount();
+		if (liveCount == 0)
+			return;
+		cpuModels = frameStream->Allocate(liveCount * sizeof(glm::mat4));
+		if (cpuModels.data == nullptr) //out of stream space, skip drawing this frame
+		{
+			liveCount = 0;
+			return;
+		}
+		pool->WriteMatrices(static_cast<glm::mat4*>(cpuModels.data));
 	}
-};
-
-class DustCloud: public Object
-{
-protected:
-	Player* target;
-	Model* copyModel;
-	unsigned long long lastSpawnTime = 0;
-	const float minSpawnDelay = 40; //min wait time in ms before we can spawn a new particle
-	const unsigned int maxParticles = 100; //max particle count
-	DustParticle** particles;
-	unsigned int particlePointer = 0;
 
-	public:
-	DustCloud(Player* _target, Model* _copyModel) : Object()
-	{
-		target = _target;
-		copyModel = new Model(*copyModel, glm::vec3(0.00f), glm::quat(1.00f, 0.00f, 0.00f, 0.00f), glm::vec3(1.00f));
-		particles = new DustParticle* [maxParticles];
-		for (unsigned int i = 0; i < maxParticles; i++) //init array
+public:
+	ParticleSystem(const char* modelPath, unsigned int _capacity, float _lifeTime, float _startScale, float _endScale)
+	{
+		model = new Model(modelPath);
+		capacity = ((_capacity + 15) / 16) * 16; //keeps the SSBO range offsets 256 byte aligned
+		lifeTime = _lifeTime;
+		startScale = _startScale;
+		endScale = _endScale;
+		lastUpdateTime = (float)eTime / 1000.00f; //else the first Update's delta would be the whole time since startup
+		spawnTimes.resize(capacity, 0.00f);
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, capacity * (sizeof(glm::vec4) * 2 + sizeof(glm::mat4)), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		if (glewIsSupported("GL_ARB_compute_shader"))
+		{
+			simulateShader = new ComputeShader(Path("particles.comp"));
+			if (!simulateShader->IsValid())
+			{
+				delete simulateShader;
+				simulateShader = nullptr;
+			}
+		}
+		if (simulateShader == nullptr)
 		{
-			particles[i] = nullptr;
+			std::cout << "Warning: Compute shaders unavailable, simulating particles on the CPU!\n";
+			pool = new ParticlePool(capacity, lifeTime, startScale, endScale);
 		}
 	}
 
-	DustCloud(Player* _target, const char* path) : Object()
+	~ParticleSystem()
 	{
-		target = _target;
-		copyModel = new Model(path, glm::vec3(0.00f), glm::quat(1.00f, 0.00f, 0.00f, 0.00f), glm::vec3(1.00f));
-		particles = new DustParticle* [maxParticles];
-		for (unsigned int i = 0; i < maxParticles; i++) //init array
-		{
-			particles[i] = nullptr;
-		}
+		delete model;
+		delete simulateShader;
+		delete pool;
+		glDeleteBuffers(1, &buffer);
+	}
+
+	void AddEmitter(ParticleEmitter* emitter)
+	{
+		emitters.push_back(emitter);
 	}
 
-	~DustCloud()
+	void RemoveEmitter(ParticleEmitter* emitter)
 	{
-		delete copyModel;
-		delete[] particles;
+		emitters.erase(std::remove(emitters.begin(), emitters.end(), emitter), emitters.end());
 	}
 
-	void SpawnParticle(glm::vec3 _position)
+	//spawn a particle with a random rotation at the next Update
+	void Emit(glm::vec3 position)
 	{
-		particlePointer = (particlePointer + 1) % maxParticles; //increment the pointer
-		delete particles[particlePointer]; //delete the old particle (should be nullptr but we delete for safety)
-		particles[particlePointer] = new DustParticle(copyModel, _position, glm::vec3(0.15f), glm::vec3(0.5f)); //create new particle
+		glm::quat rotation = glm::quat(glm::vec3(SDL_randf() * PI, SDL_randf() * PI, SDL_randf() * PI));
+		pendingPositions.push_back(glm::vec4(position, 0.00f));
+		pendingRotations.push_back(glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w));
 	}
 
+	//update the emitters, retire dead particles then spawn and animate
 	void Update()
 	{
-		for (unsigned int i = 0; i < maxParticles; i++) //loop over each particle and check if it should be deleted
+		std::for_each(emitters.begin(), emitters.end(), [&](ParticleEmitter* emitter) { emitter->Update(); });
+		float time = (float)eTime / 1000.00f;
+		float deltaTime = time - lastUpdateTime;
+		lastUpdateTime = time;
+		if (simulateShader == nullptr)
+			SimulateCPU(deltaTime);
+		else
 		{
-			if (particles[i] != nullptr)
+			while (liveCount > 0 && time - spawnTimes[GetFirstParticle()] >= lifeTime) //the oldest die first
+				liveCount--;
+			unsigned int spawnCount = glm::min((unsigned int)pendingPositions.size(), glm::min(capacity, maxSpawnsPerUpdate));
+			unsigned int spawnStart = head;
+			for (unsigned int i = 0; i < spawnCount; i++)
 			{
-				particles[i]->Update();
-				if (particles[i]->Dead())
-				{
-					delete particles[i];
-					particles[i] = nullptr;
-				}
+				pendingPositions[i].w = time;
+				spawnTimes[head] = time;
+				head = (head + 1) % capacity;
 			}
+			liveCount = glm::min(liveCount + spawnCount, capacity); //if full the oldest are overwritten
+			if (liveCount > 0)
+				SimulateGPU(time, spawnStart, spawnCount);
 		}
+		pendingPositions.clear();
+		pendingRotations.clear();
+	}
+
+	//one instanced draw per mesh of every live particle, shader must be active and read its matrices like scene.vert with PARTICLE
+	void Draw(Shader* shader)
+	{
+		if (liveCount == 0)
+			return;
+		if (pool != nullptr)
+			frameStream->BindRange(GL_SHADER_STORAGE_BUFFER, 2, cpuModels);
+		else
+			glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, buffer, GetModelsOffset(), capacity * sizeof(glm::mat4));
+		glUniform1ui(glGetUniformLocation(shader->GetProgram(), "firstParticle"), GetFirstParticle());
+		glUniform1ui(glGetUniformLocation(shader->GetProgram(), "particleCapacity"), capacity);
+		for (unsigned int i = 0; i < model->GetNumMeshes(); i++)
+		{
+			glUniform3fv(glGetUniformLocation(shader->GetProgram(), "baseColor"), 1, glm::value_ptr(model->GetMeshes()[i]->GetColor()));
+			model->GetMeshes()[i]->GetGLObject()->DrawInstanced(liveCount);
+		}
+	}
+
+	unsigned int GetFirstParticle()
+	{
+		if (pool != nullptr) //the pool is always packed from slot 0
+			return 0;
+		return (head + capacity - liveCount) % capacity;
+	}
+
+	unsigned int GetLiveCount()
+	{
+		return liveCount;
+	}
+
+	unsigned int GetCapacity()
+	{
+		return capacity;
+	}
+
+	bool IsSimulatedOnGPU()
+	{
+		return simulateShader != nullptr;
+	}
+};
+
+ParticleEmitter::ParticleEmitter(ParticleSystem* _system)
+	: Object()
+{
+	system = _system;
+	system->AddEmitter(this);
+}
+
+ParticleEmitter::~ParticleEmitter()
+{
+	system->RemoveEmitter(this);
+}
+
+unsigned int ParticleEmitter::GetLiveCount()
+{
+	return system->GetLiveCount();
+}
+
+//kicks up dust behind the player's tracks when they move fast on the ground
+class DustCloud : public ParticleEmitter
+{
+protected:
+	Player* target;
+	unsigned long long lastSpawnTime = 0;
+	const float minSpawnDelay = 40; //min wait time in ms before we can spawn a new particle
 
+public:
+	DustCloud(Player* _target, ParticleSystem* _system)
+		: ParticleEmitter(_system)
+	{
+		target = _target;
+	}
+
+	void Update()
+	{
 		PxRigidDynamic* pBody = target->GetPBody();
 		glm::vec3 playerSpeed = FromPxVec(pBody->getLinearVelocity());
 		playerSpeed.y = 0.00f;
@@ -1542,72 +2047,192 @@ protected:
 			if (eTime - lastSpawnTime >= minSpawnDelay)
 			{
 				//spawn particle at each track
-				SpawnParticle(target->LocalToWorldPoint(glm::vec3(0.33f, 0.08f, -0.33f)));
-				SpawnParticle(target->LocalToWorldPoint(glm::vec3(-0.33f, 0.08f, -0.33f)));
+				system->Emit(target->LocalToWorldPoint(glm::vec3(0.33f, 0.08f, -0.33f)));
+				system->Emit(target->LocalToWorldPoint(glm::vec3(-0.33f, 0.08f, -0.33f)));
 				lastSpawnTime = eTime; //reset spawn cooldown
 			}
 		}
 	}
-
-	void Draw()
-	{
-		for (unsigned int i = 0; i < maxParticles; i++) //loop over each particle
-		{
-			if (particles[i] != nullptr) //if it exists
-			{
-				particles[i]->Draw(); //draw it
-			}
-		}
-	}
 };
 
 class Sun: public Light
 {
+public:
+	static constexpr int maxCascades = 4; //must match MAX_CASCADES in outline.frag
+
 protected:
 	float strength;
-	GLFramebuffer* shadowBuffer;
-	const int shadowMapSize = 4096;
+	TextureArray* shadowMaps; //one depth layer per cascade
+	TextureArray* staticShadowMaps; //cached depth of the static casters, copied into shadowMaps each frame
+	unsigned int shadowFramebuffer = 0;
+	int shadowMapSize;
+	int numCascades;
+	float shadowDistance = 30.00f; //shadows aren't drawn further than this from the camera
+	float splitLambda = 0.75f; //blend between logarithmic (1.0) and uniform (0.0) splits
+	float casterMargin = 20.00f; //extra depth towards the sun so casters outside the view still cast into it
+	float cacheSnapFraction = 0.125f; //cascades only move in steps of this fraction of their radius so the static cache stays valid
+	float splits[maxCascades + 1];
+	glm::mat4 cascadeMatrices[maxCascades];
+	glm::mat4 cachedMatrices[maxCascades]; //the matrix each static layer was drawn with
+	float texelSizes[maxCascades]; //world units per shadow map texel, part of the matrix so a cached layer's LODs stay right for it
+	bool staticValid[maxCascades];
 
 public:
-	Sun(glm::vec3 _pos)
+	Sun(glm::vec3 _pos, int _numCascades = 3, int _shadowMapSize = 2048, GLenum depthFormat = GL_DEPTH_COMPONENT24)
 	{
 		pos = _pos;
 		strength = 100.00f;
-		shadowBuffer = new GLFramebuffer(shadowMapSize, shadowMapSize);
-		shadowBuffer->GetDepth()->Use(2);
+		numCascades = glm::clamp(_numCascades, 1, maxCascades);
+		shadowMapSize = _shadowMapSize;
+		shadowMaps = new TextureArray(shadowMapSize, shadowMapSize, numCascades, depthFormat); //GL_DEPTH_COMPONENT16 halves the memory if precision allows
+		staticShadowMaps = new TextureArray(shadowMapSize, shadowMapSize, numCascades, depthFormat);
+		glCreateFramebuffers(1, &shadowFramebuffer);
+		glNamedFramebufferDrawBuffer(shadowFramebuffer, GL_NONE); //depth only
+		glNamedFramebufferReadBuffer(shadowFramebuffer, GL_NONE); //..
+		for (int i = 0; i <= maxCascades; i++)
+			splits[i] = 0.00f;
+		for (int i = 0; i < maxCascades; i++)
+		{
+			cascadeMatrices[i] = glm::mat4(1.00f);
+			cachedMatrices[i] = glm::mat4(1.00f);
+			texelSizes[i] = 1.00f;
+			staticValid[i] = false;
+		}
+		shadowMaps->Use(2);
 	}
 
 	~Sun()
 	{
-		delete shadowBuffer;
+		glDeleteFramebuffers(1, &shadowFramebuffer);
+		delete shadowMaps;
+		delete staticShadowMaps;
 	}
 
-	glm::mat4 CalculateCombinedMatrix()
+	//split the camera frustum and fit a texel snapped ortho box around each slice
+	void UpdateCascades(Camera* camera)
 	{
-		const float nearPlane = 0.10f;
-		const float farPlane = 15.00f;
-		glm::mat4 projection = glm::ortho(-15.00f, 15.00f, -15.00f, 15.00f, nearPlane, farPlane);
-		glm::mat4 view = glm::lookAt(pos, glm::vec3(0.00f), glm::vec3(0.00f, 1.00f, 0.00f));
-		return projection * view;
+		float nearPlane = camera->GetNearPlane();
+		float farPlane = glm::min(camera->GetFarPlane(), shadowDistance);
+		splits[0] = nearPlane;
+		for (int i = 1; i <= numCascades; i++)
+		{
+			float p = static_cast<float>(i) / static_cast<float>(numCascades);
+			float logSplit = nearPlane * glm::pow(farPlane / nearPlane, p);
+			float uniformSplit = nearPlane + (farPlane - nearPlane) * p;
+			splits[i] = glm::mix(uniformSplit, logSplit, splitLambda); //practical split scheme
+		}
+
+		glm::vec3 lightDir = glm::normalize(-pos);
+		glm::vec3 up = glm::abs(lightDir.y) > 0.99f ? glm::vec3(0.00f, 0.00f, 1.00f) : glm::vec3(0.00f, 1.00f, 0.00f);
+		glm::mat4 lightView = glm::lookAt(glm::vec3(0.00f), lightDir, up); //only the direction matters for a sun
+		for (int i = 0; i < numCascades; i++)
+		{
+			glm::mat4 sliceProjection = glm::perspective(camera->GetFieldOfView(), camera->GetAspect(), splits[i], splits[i + 1]);
+			glm::mat4 inverseMatrix = glm::inverse(sliceProjection * camera->GetView());
+			glm::vec3 corners[8];
+			glm::vec3 center = glm::vec3(0.00f);
+			for (int c = 0; c < 8; c++)
+			{
+				glm::vec4 corner = inverseMatrix * glm::vec4((c & 1) ? 1.00f : -1.00f, (c & 2) ? 1.00f : -1.00f, (c & 4) ? 1.00f : -1.00f, 1.00f); //ndc cube corner to world
+				corners[c] = glm::vec3(corner) / corner.w;
+				center += corners[c];
+			}
+			center /= 8.00f;
+			float radius = 0.00f;
+			for (int c = 0; c < 8; c++)
+				radius = glm::max(radius, glm::length(corners[c] - center));
+			radius = glm::ceil(radius * 16.00f) / 16.00f; //fitting a sphere keeps the box size constant as the camera rotates
+
+			//grow the box so the centre can be snapped to a coarse grid and still contain the slice
+			float paddedRadius = radius * (1.00f + cacheSnapFraction);
+			float texelSize = (2.00f * paddedRadius) / static_cast<float>(shadowMapSize);
+			texelSizes[i] = texelSize;
+			float snapSize = glm::max(glm::floor(radius * cacheSnapFraction / texelSize), 1.00f) * texelSize; //whole texels so edges don't shimmer either
+			glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.00f));
+			lightCenter = glm::floor(lightCenter / snapSize) * snapSize;
+			glm::mat4 projection = glm::ortho(lightCenter.x - paddedRadius, lightCenter.x + paddedRadius, lightCenter.y - paddedRadius, lightCenter.y + paddedRadius,
+				-lightCenter.z - paddedRadius - casterMargin, -lightCenter.z + paddedRadius);
+			cascadeMatrices[i] = projection * lightView;
+		}
+	}
+
+	glm::mat4 GetCascadeMatrix(int cascade)
+	{
+		return cascadeMatrices[cascade];
+	}
+
+	//for picking LODs, the projection is orthographic so this is the same at any distance
+	float GetTexelsPerUnit(int cascade)
+	{
+		return 1.00f / texelSizes[cascade];
+	}
+
+	int GetNumCascades()
+	{
+		return numCascades;
+	}
+
+	TextureArray* GetShadowMaps()
+	{
+		return shadowMaps;
+	}
+
+	//set the sun and cascade uniforms on a shader that samples the shadow maps
+	void SetUniforms(Shader* shader)
+	{
+		shader->SetUniforms(cascadeMatrices[0], pos);
+		glm::uint oldProgram = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, reinterpret_cast<int*>(&oldProgram));
+		glUseProgram(shader->GetProgram());
+		glUniformMatrix4fv(glGetUniformLocation(shader->GetProgram(), "sunMatrices"), numCascades, false, glm::value_ptr(cascadeMatrices[0]));
+		glUniform1i(glGetUniformLocation(shader->GetProgram(), "numCascades"), numCascades);
+		glUseProgram(oldProgram);
 	}
 
-	void StartShadowPass(Shader* shader)
+	//throw away the cached static layers, call when static casters are added, removed or moved
+	void InvalidateStaticShadows()
+	{
+		for (int i = 0; i < maxCascades; i++)
+			staticValid[i] = false;
+	}
+
+	//returns true if the static casters need drawing into this cascade's cache, otherwise the cache can be reused
+	bool StartStaticShadowPass(Shader* shader, int cascade)
+	{
+		if (staticValid[cascade] && cachedMatrices[cascade] == cascadeMatrices[cascade]) //cache is still good
+			return false;
+		glCullFace(GL_FRONT);
+		shader->Use();
+		shader->SetUniforms(cascadeMatrices[cascade], pos);
+		glNamedFramebufferTextureLayer(shadowFramebuffer, GL_DEPTH_ATTACHMENT, staticShadowMaps->GetTexture(), 0, cascade); //render into the cache
+		glViewport(0, 0, shadowMapSize, shadowMapSize);
+		glBindFramebuffer(GL_FRAMEBUFFER, shadowFramebuffer);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		cachedMatrices[cascade] = cascadeMatrices[cascade];
+		staticValid[cascade] = true;
+		return true;
+	}
+
+	//starts the per frame pass, the cached static depth is copied in first so only dynamic casters need drawing
+	void StartShadowPass(Shader* shader, int cascade)
 	{
 		glCullFace(GL_FRONT);
 		//glEnable(GL_POLYGON_OFFSET_FILL); //should fix the shadow aliasing //re-enable if shadow aliasing appears again
 		//glPolygonOffset(1.f, 1); //other stuff https://learn.microsoft.com/en-gb/windows/win32/dxtecharts/common-techniques-to-improve-shadow-depth-maps
 		shader->Use();
-		shader->SetUniforms(CalculateCombinedMatrix(), pos);
+		shader->SetUniforms(cascadeMatrices[cascade], pos);
+		glCopyImageSubData(staticShadowMaps->GetTexture(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade,
+			shadowMaps->GetTexture(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade, shadowMapSize, shadowMapSize, 1); //start from the static casters
+		glNamedFramebufferTextureLayer(shadowFramebuffer, GL_DEPTH_ATTACHMENT, shadowMaps->GetTexture(), 0, cascade); //render into this cascade's layer
 		glViewport(0, 0, shadowMapSize, shadowMapSize);
-		shadowBuffer->Use();
-		glClear(GL_DEPTH_BUFFER_BIT);
+		glBindFramebuffer(GL_FRAMEBUFFER, shadowFramebuffer);
 	}
 
 	void EndShadowPass()
 	{
 		glCullFace(GL_BACK);
 		//glDisable(GL_POLYGON_OFFSET_FILL);
-		shadowBuffer->GetDepth()->Use(2);
+		shadowMaps->Use(2);
 		glViewport(0, 0, (int)screenWidth, (int)screenHeight);
 	}
 };
@@ -1639,13 +2264,16 @@ public:
 		stamina = val;
 	}
 
-	//Use and setup the emissive shader before calling
-	void Draw(Shader* currentShader, Shader* diffuseShader) //diffuse shader should be already setup
+	//queue the bar as emissive and the frame with the diffuse shader, both shaders should be already setup
+	void Queue(RenderQueue& queue, Shader* emissiveShader, Shader* diffuseShader)
 	{
-		meshes[0]->Draw();
-		diffuseShader->Use();
-		meshes[1]->Draw();
-		currentShader->Use();
+		queue.Push(meshes[0], emissiveShader);
+		queue.Push(meshes[1], diffuseShader);
+	}
+
+	void Queue(RenderQueue& queue, Shader* shader)
+	{
+		Model::Queue(queue, shader);
 	}
 
 	void Draw()
@@ -1718,15 +2346,27 @@ public:
 		SetRotation(target->Model::GetRotation());
 	}
 
-	//Use and setup the emissive shader before calling
-	void Draw(Shader* currentShader, Shader* diffuseShader) //diffuse shader should be already setup
+	//queue the light with the emissive shader, it should be already setup
+	void Queue(RenderQueue& queue, Shader* emissiveShader)
 	{
 		if (platformToggle != initalState) //xor
 			meshes[0]->SetColor(glm::vec3(0.f, 0.8f, 0.f));
 		else
 			meshes[0]->SetColor(glm::vec3(0.8f, 0.f, 0.f));
-		meshes[0]->Draw();
-		diffuseShader->Use();
+		queue.Push(meshes[0], emissiveShader);
+	}
+
+	//queue every mesh, used for drawing to maps
+	void QueueAll(RenderQueue& queue, Shader* shader)
+	{
+		Model::Queue(queue, shader);
+	}
+
+	//the light the bulb gives off, for the deferred lighting pass
+	PointLight GetPointLight()
+	{
+		glm::vec3 color = platformToggle != initalState ? glm::vec3(0.f, 0.8f, 0.f) : glm::vec3(0.8f, 0.f, 0.f); //same as Queue
+		return MakePointLight(LocalToWorldPoint(glm::vec3(0.00f, 0.20f, 0.00f)), color, 1.00f, 0.70f, 1.80f);
 	}
 
 	void Draw() //used for drawing to maps
@@ -1868,6 +2508,10 @@ void KeyDown(SDL_KeyboardEvent key)
 			LoadLevel01();
 		}
 		break;
+	case(key_Stats):
+		if (!key.repeat)
+			showStats = !showStats;
+		break;
 	}
 }
 
@@ -1988,8 +2632,10 @@ void LoadLevel01()
 	platformToggle = false;
 	toggleShader->Use();
 	glUniform3fv(glGetUniformLocation(toggleShader->GetProgram(), "colour"), 1, glm::value_ptr(glm::vec3(1.f, 0.f, 0.f)));
-	delete playerCloud;
-	playerCloud = new DustCloud(player, Path("models/ball.obj"));
+	delete playerCloud; //before its system
+	delete dustParticles;
+	dustParticles = new ParticleSystem(Path("models/ball.obj"), 128, 0.67f, 0.15f, 0.50f);
+	playerCloud = new DustCloud(player, dustParticles);
 	delete stamBar;
 	stamBar = new StaminaBar(Path("models/stamina_bar.obj"), player);
 	toggleTexture->Use(5);
@@ -2198,8 +2844,8 @@ void LoadLevel01()
 	delete pistonLightCopyModel;
 
 	//place "coins"
-	Model* nutModel = new Model(Path("models/nut.obj"));
-	Model* boltModel = new Model(Path("models/bolt.obj"));
+	Model* nutModel = new Model(Path("models/nut.obj"), glm::vec3(0.f), glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3(1.f), true, 0, VertexFormat::packedHalf); //small enough for half positions
+	Model* boltModel = new Model(Path("models/bolt.obj"), glm::vec3(0.f), glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3(1.f), true, 0, VertexFormat::packedHalf);
 
 	numCoins = 50;
 	coins = new Coin* [numCoins];
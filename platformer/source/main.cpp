@@ -3,6 +3,10 @@
 int init();
 void HandleEvents();
 void Draw();
+void BuildRenderGraph();
+void ParseArguments(int argc, char** argv);
+int RunBenchmark();
+void UpdateStatsOverlay();
 
 Shader* outlineBufferShader;
 Shader* outlineShader;
@@ -11,21 +15,66 @@ Shader* emissiveOutlineShader;
 Shader* animatedShadowShader;
 Shader* animatedOutlineBufferShader;
 Shader* fullScreenShader;
+Shader* outlinePostShader;
+Shader* hiZShader;
+Shader* particleOutlineBufferShader;
+Shader* particleOutlineShader;
+Shader* particleShadowShader;
+Shader* emissiveOutlineBufferShader;
+Shader* deferredSunShader;
+Shader* deferredPointLightShader;
+Shader* statsOverlayShader;
 Texture* mainMenuTexture;
 File* testFile;
 Model* testModel;
 Sun* sun;
 Model* levelTestModel;
 Model* toggle;
+std::vector<unsigned char> cameraVisibility; //per pass cull results, indexed by bounds slot
+std::vector<unsigned char> cascadeVisibility[Sun::maxCascades];
+std::vector<Model*> staticCasters; //drawModels that are drawn into the cached shadow layers
+std::vector<Model*> dynamicCasters; //drawModels that are redrawn into the shadow maps every frame
+std::vector<Model*> previousStaticCasters;
+RenderGraph* renderGraph;
+bool deferredLighting = true; //light from the G-buffer in one full screen pass plus a rect per point light instead of per object, read when the shaders and graph are built
+DynamicResolution* dynamicResolution;
+OcclusionCuller* occlusionCuller;
+TextOverlay* statsOverlay; //F3, see UpdateStatsOverlay
+
+//a scripted fly through of level 01 instead of the game, for timing passes and checking frames against reference images
+//e.g. Platformer --headless --software --size 640x360 --dump frames/ or --golden frames/
+struct BenchmarkSettings
+{
+	bool enabled = false;
+	bool headless = false; //no window, SDL's offscreen driver makes the context through EGL so no display is needed
+	bool software = false; //ask Mesa for llvmpipe so the frames don't depend on the GPU
+	int width = 1920;
+	int height = 1080;
+	int frames = 600; //spread over the whole camera path
+	int warmup = 30; //left out of the timings while the caches fill and the timer queries catch up
+	int captures = 8; //frames dumped or compared, spread evenly along the path
+	int tolerance = 8; //per channel difference that still counts as a matching pixel
+	float maxMismatch = 0.001f; //fraction of pixels that may differ before a capture fails
+	std::string dumpPath; //directory to write the captures to
+	std::string goldenPath; //directory of reference captures to compare against
+	std::string reportPath; //CSV of the per pass timings
+};
+BenchmarkSettings benchmark;
+GLFramebuffer* offscreenTarget = nullptr; //stands in for the window while benchmarking so the captures never depend on it
 
 int main(int argc, char** argv)
 {
 	bool running = true;
-	init();
+	ParseArguments(argc, argv);
+	if (init() != 0)
+		return quit(-1);
 
 	LoadMainMenu();
 
-	levelTestModel = new Model(Path("models/level_01_static.obj"), glm::vec3(0.0f, -0.50f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+	levelTestModel = new Model(Path("models/level_01_static.obj"), glm::vec3(0.0f, -0.50f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f), true, 1024); //split into clusters of 1024 tris for culling
+
+	if (benchmark.enabled)
+		return quit(RunBenchmark());
 
 	eTime = SDL_GetTicks();
 
@@ -51,6 +100,7 @@ int main(int argc, char** argv)
 				LoadLevel01();
 				continue;
 			}
+			frameStream->BeginFrame(); //waits if the GPU still needs the region this frame writes to
 			player->SetGrounded(false); //before pContactCallback set player.isGrounded to false (pContactCallback will set it to true if grounded)
 			float fTime = static_cast<float>(dTime + 1) / 1000.00f; //+1 so that fTime is never 0 (crashes physx)
 			pScene->simulate(fTime); //simulate by delta time
@@ -59,7 +109,7 @@ int main(int argc, char** argv)
 			std::for_each(pObjects.begin(), pObjects.end(), [&](PhysicsObject* pObject) { pObject->Update(); });
 			if (player != nullptr)
 				player->Update();
-			playerCloud->Update();
+			dustParticles->Update(); //updates playerCloud too
 			stamBar->Update();
 			for (unsigned long long int i = 0; i < numCoins; i++)
 			{
@@ -103,23 +153,81 @@ void HandleEvents()
 
 int init()
 {
+	if (benchmark.software) //must be set before the GL library is loaded
+	{
+		SDL_setenv_unsafe("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+		SDL_setenv_unsafe("GALLIUM_DRIVER", "llvmpipe", 1);
+	}
+	if (benchmark.headless)
+	{
+		SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+		SDL_SetHint(SDL_HINT_AUDIO_DRIVER, "dummy"); //there may be no sound device either
+	}
 	if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO))
 	{
+		std::cout << "Error: Couldn't init SDL: " << SDL_GetError() << "\n";
 		return -1; //failed to init SDL
 	}
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE); //use OpenGL core
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4); //use OpenGL 4.x
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 5); //use OpenGL x.5
-	screenWidth = 1920.00f;
-	screenHeight = 1080.00f;
-	window = SDL_CreateWindow("Platformer", (int)screenWidth, (int)screenHeight, SDL_WINDOW_FULLSCREEN | SDL_WINDOW_OPENGL);
-	SDL_SetWindowRelativeMouseMode(window, true); //capture the mouse
+	screenWidth = benchmark.enabled ? (float)benchmark.width : 1920.00f;
+	screenHeight = benchmark.enabled ? (float)benchmark.height : 1080.00f;
+	if (benchmark.enabled)
+		window = SDL_CreateWindow("Platformer", (int)screenWidth, (int)screenHeight, SDL_WINDOW_OPENGL | (benchmark.headless ? SDL_WINDOW_HIDDEN : 0));
+	else
+	{
+		window = SDL_CreateWindow("Platformer", (int)screenWidth, (int)screenHeight, SDL_WINDOW_FULLSCREEN | SDL_WINDOW_OPENGL);
+		SDL_SetWindowRelativeMouseMode(window, true); //capture the mouse
+	}
 	SDL_GLContext glContext = SDL_GL_CreateContext(window); //Create GL context
 	if (!glContext) //if failed to create context
+	{
+		std::cout << "Error: Couldn't create an OpenGL 4.5 core context: " << SDL_GetError() << "\n";
 		quit(-1); //close
+	}
 	GLenum glew = glewInit(); //init glew
+	if (glew == GLEW_ERROR_NO_GLX_DISPLAY && benchmark.headless) //EGL contexts have no GLX display, the GL functions themselves are already loaded
+		glew = GLEW_OK;
 	if (glew != GLEW_OK) //if glew didn't work
 		quit(-1); //close
+	if (benchmark.enabled)
+		std::cout << "Renderer: " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")\n";
+
+	//load shaders, this only queues the compiles so the driver can work on them while we set everything else up
+	unsigned long long shaderStart = SDL_GetPerformanceCounter();
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); //let the driver pick how many threads
+	shaderCache = new ShaderCache();
+	errorShader = new Shader(true);
+	errorShader->Use();
+	//the mesh shaders are variants of scene.vert and outline.frag, see the defines at the top of each
+	shadowShader = GetShaderVariant(Path("scene.vert"), Path("basic.frag"), { "SHADOW_ONLY" });
+	animatedShadowShader = GetShaderVariant(Path("scene.vert"), Path("basic.frag"), { "SHADOW_ONLY", "ANIMATED" });
+	outlineShader = GetShaderVariant(Path("scene.vert"), Path("outline.frag"), { "NUM_LIGHTS=1" });
+	animatedOutlineShader = GetShaderVariant(Path("scene.vert"), Path("outline.frag"), { "ANIMATED", "NUM_LIGHTS=1" });
+	emissiveOutlineShader = GetShaderVariant(Path("scene.vert"), Path("outline.frag"), { "EMISSIVE" });
+	std::string gBuffer = deferredLighting ? "DEFERRED" : ""; //the outline buffer doubles as the G-buffer
+	outlineBufferShader = GetShaderVariant(Path("scene.vert"), Path("outline_buffer.frag"), { "OUTLINE_BUFFER", gBuffer });
+	animatedOutlineBufferShader = GetShaderVariant(Path("scene.vert"), Path("outline_buffer.frag"), { "OUTLINE_BUFFER", "ANIMATED", gBuffer });
+	emissiveOutlineBufferShader = outlineBufferShader; //emissive only matters to the G-buffer
+	deferredSunShader = nullptr;
+	deferredPointLightShader = nullptr;
+	if (deferredLighting)
+	{
+		emissiveOutlineBufferShader = GetShaderVariant(Path("scene.vert"), Path("outline_buffer.frag"), { "OUTLINE_BUFFER", "EMISSIVE", gBuffer });
+		deferredSunShader = GetShaderVariant(Path("outline_post.vert"), Path("outline.frag"), { "DEFERRED", "NUM_LIGHTS=0" }); //point lights are drawn as volumes
+		deferredPointLightShader = GetShaderVariant(Path("point_light.vert"), Path("outline.frag"), { "DEFERRED", "POINT_LIGHT", "NUM_LIGHTS=0" });
+	}
+	fullScreenShader = new Shader(Path("fullscreen.vert"), Path("fullscreen.frag"));
+	outlinePostShader = new Shader(Path("outline_post.vert"), Path("outline_post.frag"));
+	particleOutlineBufferShader = GetShaderVariant(Path("scene.vert"), Path("outline_buffer.frag"), { "OUTLINE_BUFFER", "PARTICLE", gBuffer });
+	particleOutlineShader = GetShaderVariant(Path("scene.vert"), Path("outline.frag"), { "PARTICLE", "NUM_LIGHTS=1" });
+	particleShadowShader = GetShaderVariant(Path("scene.vert"), Path("basic.frag"), { "SHADOW_ONLY", "PARTICLE" });
+	hiZShader = new Shader(Path("outline_post.vert"), Path("hiz_downsample.frag")); //same full screen triangle
+	toggleShader = new Shader(Path("fullscreen.vert"), Path("toggle.frag"));
+	statsOverlayShader = new Shader(Path("stats_overlay.vert"), Path("stats_overlay.frag"));
+	unsigned long long int shaderIssueTicks = SDL_GetPerformanceCounter() - shaderStart - shaderFinishTicks; //the waits so far are counted below
 	eTime = SDL_GetTicks();
 
 	pFoundation = PxCreateFoundation(PX_PHYSICS_VERSION, pAlloc, pError); //create the "foundation"
@@ -134,40 +242,58 @@ int init()
 	sceneDesc.simulationEventCallback = &pContactCallback;
 	pScene = pPhysics->createScene(sceneDesc); //create the scene
 	pScene->setSimulationEventCallback(&pContactCallback);
+	PollShaders();
 
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
-	//load shaders
-	errorShader = new Shader(true);
-	errorShader->Use();
-	shadowShader = new Shader(Path("shadow.vert"), Path("basic.frag"));
-	animatedShadowShader = new Shader(Path("shadow_animated.vert"), Path("basic.frag"));
-	outlineShader = new Shader(Path("outline.vert"), Path("outline.frag"));
-	animatedOutlineShader = new Shader(Path("outline_animated.vert"), Path("outline.frag"));
-	emissiveOutlineShader = new Shader(Path("outline.vert"), Path("emissive_outline.frag"));
-	outlineBufferShader = new Shader(Path("outline_buffer.vert"), Path("outline_buffer.frag"));
-	animatedOutlineBufferShader = new Shader(Path("outline_buffer_animated.vert"), Path("outline_buffer.frag"));
-	fullScreenShader = new Shader(Path("fullscreen.vert"), Path("fullscreen.frag"));
-	toggleShader = new Shader(Path("fullscreen.vert"), Path("toggle.frag"));
+	geometryArena = new GeometryArena(32 * 1024 * 1024, 16 * 1024 * 1024); //32MB of vertices, 16MB of indices shared by every static mesh
+	frameStream = new StreamBuffer(4 * 1024 * 1024, 3); //4MB per frame, 3 frames in flight
+	mainMenuTexture = new Texture(Path("textures/main_menu.png"));
+	mainMenuTexture->Use(5);
+	toggleTexture = new Texture(Path("textures/toggle.png"));
+	PollShaders();
+	mainCamera = new Camera(glm::vec3(0.00f), glm::radians(90.00f));
+	sun = new Sun(glm::vec3(-5.00f, 5.00f, -1.00f));
+	toggle = new Model(Path("models/plane.obj"), glm::vec3(0.00f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.1f));
+	PollShaders();
+
+	//everything below needs the programs so waits on any still building
 	fullScreenShader->Use();
 	glUniform1i(glGetUniformLocation(fullScreenShader->GetProgram(), "mainMenuTex"), 5);
 	glUniform1i(glGetUniformLocation(fullScreenShader->GetProgram(), "textAtlas"), 6);
 	toggleShader->Use();
 	glUniform1i(glGetUniformLocation(toggleShader->GetProgram(), "tex"), 5);
 	glUniform3fv(glGetUniformLocation(toggleShader->GetProgram(), "colour"), 1, glm::value_ptr(glm::vec3(1.f, 0.f, 0.f)));
-	
-	mainMenuTexture = new Texture(Path("textures/main_menu.png"));
-	mainMenuTexture->Use(5);
-	toggleTexture = new Texture(Path("textures/toggle.png"));
-	mainCamera = new Camera(glm::vec3(0.00f), glm::radians(90.00f));
-	depthBuffer = new GLFramebuffer();
-	depthBuffer->GetColor()->Use(3); //set which texture units to use with the buffer
-	depthBuffer->GetDepth()->Use(4);
+	glProgramUniform1i(outlinePostShader->GetProgram(), glGetUniformLocation(outlinePostShader->GetProgram(), "sceneMap"), 7);
+	glProgramUniform1i(hiZShader->GetProgram(), glGetUniformLocation(hiZShader->GetProgram(), "depthMap"), 4);
+	if (deferredLighting)
+	{
+		Shader* deferredShaders[] = { deferredSunShader, deferredPointLightShader };
+		for (Shader* shader : deferredShaders)
+		{
+			glProgramUniform1i(shader->GetProgram(), glGetUniformLocation(shader->GetProgram(), "albedoMap"), 9);
+			glProgramUniform1i(shader->GetProgram(), glGetUniformLocation(shader->GetProgram(), "gNormalMap"), 10);
+		}
+	}
+	occlusionCuller = new OcclusionCuller((int)screenWidth, (int)screenHeight);
+	statsOverlay = new TextOverlay(statsOverlayShader, 88, 24);
+	dynamicResolution = new DynamicResolution(12.00f, 0.50f, 1.00f); //aim for 12ms of GPU work, drawing the scene at between half and full resolution
 
 	SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 4); //enable multisampling
 
-	sun = new Sun(glm::vec3(-5.00f, 5.00f, -1.00f));
-	toggle = new Model(Path("models/plane.obj"), glm::vec3(0.00f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.1f));
+	BuildRenderGraph();
+	if (benchmark.enabled)
+	{
+		offscreenTarget = new GLFramebuffer(); //screen sized color and depth
+		renderGraph->SetBackbufferFramebuffer(offscreenTarget->GetFramebuffer());
+	}
+	FinishShaders();
+	//only issuing the compiles and waiting on them counts as shader time, the init work done in between is timed on its own
+	double ticksToMs = 1000.00 / (double)SDL_GetPerformanceFrequency();
+	double shaderTime = (double)(shaderIssueTicks + shaderFinishTicks) * ticksToMs;
+	double initTime = (double)(SDL_GetPerformanceCounter() - shaderStart) * ticksToMs;
+	std::cout << "Shaders ready in " << shaderTime << "ms (" << shaderCache->GetHits() << " from cache, " << shaderCache->GetMisses() << " compiled), init took "
+		<< initTime << "ms\n"; //all from cache is a hot start
 
 	glClearColor(0.529f, 0.808f, 0.922f, 1.f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -175,84 +301,499 @@ int init()
 	return 0;
 }
 
-void Draw()
+//queue the static models that are lit normally
+void QueueLitModels(Shader* shader)
 {
-	Shader* shader;
-	depthBuffer->Use();
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); //clear frame buffer
-	//outline buffer pass (draw worldspace normals and depth buffer)
-	shader = outlineBufferShader;
-	shader->Use();
-	shader->SetUniforms();
-	std::for_each(drawModels.begin(), drawModels.end(), [&](Model* drawModel) { drawModel->Draw(); }); //loop over each element in drawModel and draw it
-	playerCloud->Draw();
-	stamBar->Draw();
-	for (unsigned long long int i = 0; i < numCoins; i++) //loop over each coin and draw it
+	std::for_each(drawModels.begin(), drawModels.end(), [&](Model* drawModel) { drawModel->Queue(renderQueue, shader); });
+	for (unsigned long long int i = 0; i < numCoins; i++)
 	{
 		if (coins[i] != nullptr)
-			coins[i]->Draw();
+			coins[i]->Queue(renderQueue, shader);
 	}
-	std::for_each(pistonLights.begin(), pistonLights.end(), [&](PistonLight* pistonLight) { pistonLight->Draw(); });
-	levelTestModel->Draw();
-	shader = animatedOutlineBufferShader;
-	shader->Use();
-	shader->SetUniforms();
+	levelTestModel->Queue(renderQueue, shader);
+}
+
+//draw the animated objects, they can't go through the render queue
+void DrawAnimated(Shader* shader)
+{
 	player->Draw(shader);
 	std::for_each(pistons.begin(), pistons.end(), [&](Piston* pistons) { pistons->Draw(shader); });
+}
 
-	//shadow pass
-	glEnable(GL_MULTISAMPLE);
-	shader = shadowShader;
-	sun->StartShadowPass(shader);
-	std::for_each(drawModels.begin(), drawModels.end(), [&](Model* drawModel) { drawModel->Draw(); });
-	stamBar->Draw();
-	playerCloud->Draw();
-	for (unsigned long long int i = 0; i < numCoins; i++)
+//tell a full screen shader how much of the scene targets were drawn to
+void SetRenderScaleUniforms(Shader* shader)
+{
+	glUniform1f(glGetUniformLocation(shader->GetProgram(), "renderScale"), renderGraph->GetRenderScale());
+	glUniform2i(glGetUniformLocation(shader->GetProgram(), "renderSize"), renderGraph->GetRenderWidth(), renderGraph->GetRenderHeight());
+}
+
+//declare every pass with what it reads and writes, the graph works out targets, clears and order
+void BuildRenderGraph()
+{
+	glm::vec4 skyColor = glm::vec4(0.529f, 0.808f, 0.922f, 1.f);
+	renderGraph = new RenderGraph();
+	int sceneWidth = (int)ceilf(screenWidth * dynamicResolution->GetMaxScale()); //scene targets fit the largest render scale
+	int sceneHeight = (int)ceilf(screenHeight * dynamicResolution->GetMaxScale());
+	unsigned int outlineColor = renderGraph->CreateTarget("outline normals", sceneWidth, sceneHeight, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, true, skyColor);
+	unsigned int sceneDepth = renderGraph->CreateTarget("scene depth", sceneWidth, sceneHeight, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, true, glm::vec4(1.00f));
+	unsigned int sceneColor = renderGraph->CreateTarget("scene color", sceneWidth, sceneHeight, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, true, skyColor);
+	unsigned int albedo = renderGraph->CreateTarget("g-buffer albedo", sceneWidth, sceneHeight, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, true); //only used by the deferred path
+	unsigned int worldNormal = renderGraph->CreateTarget("g-buffer normal", sceneWidth, sceneHeight, GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, true);
+	unsigned int hiZ = renderGraph->CreateTarget("hi-z", occlusionCuller->GetWidth(), occlusionCuller->GetHeight(), GL_R32F, GL_RED, GL_FLOAT, false);
+	unsigned int shadowMap = renderGraph->ImportTexture("shadow maps", sun->GetShadowMaps());
+	unsigned int backbuffer = renderGraph->ImportBackbuffer("backbuffer", true);
+
+	//outline buffer pass (draw worldspace normals and depth buffer, and albedo and world normals for the deferred path)
+	RenderPass* pass = renderGraph->AddPass("outline buffer", []()
+		{
+			cullResults = cameraVisibility.data();
+			lodView = LodView{ mainCamera->GetEyePosition(), mainCamera->GetPixelsPerUnit() * renderGraph->GetRenderScale(), 1.00f }; //the main pass must pick the same LODs to match this depth
+			Shader* shader = outlineBufferShader;
+			shader->SetUniforms();
+			emissiveOutlineBufferShader->SetUniforms();
+			renderQueue.Begin(mainCamera->GetEyePosition());
+			QueueLitModels(shader);
+			stamBar->Queue(renderQueue, emissiveOutlineBufferShader, shader);
+			if (deferredLighting) //the bulbs are marked emissive in the G-buffer
+				std::for_each(pistonLights.begin(), pistonLights.end(), [&](PistonLight* pistonLight) { pistonLight->Queue(renderQueue, emissiveOutlineBufferShader); });
+			else
+				std::for_each(pistonLights.begin(), pistonLights.end(), [&](PistonLight* pistonLight) { pistonLight->QueueAll(renderQueue, shader); });
+			renderQueue.Flush(); //sort and draw
+			shader = animatedOutlineBufferShader;
+			shader->Use();
+			shader->SetUniforms();
+			DrawAnimated(shader);
+			shader = particleOutlineBufferShader;
+			shader->Use();
+			shader->SetUniforms();
+			dustParticles->Draw(shader);
+		});
+	pass->Write(outlineColor);
+	if (deferredLighting)
 	{
-		if (coins[i] != nullptr)
-			coins[i]->Draw();
+		pass->Write(albedo);
+		pass->Write(worldNormal);
 	}
-	std::for_each(pistonLights.begin(), pistonLights.end(), [&](PistonLight* pistonLight) { pistonLight->Draw(); });
-	levelTestModel->Draw();
-	shader = animatedShadowShader;
-	shader->Use();
-	shader->SetUniforms(sun->CalculateCombinedMatrix(), sun->GetPosition());
-	player->Draw(shader);
-	std::for_each(pistons.begin(), pistons.end(), [&](Piston* pistons) { pistons->Draw(shader); });
-	sun->EndShadowPass();
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); //clear frame buffer
-	//main pass
-	shader = outlineShader;
-	shader->Use();
-	shader->SetUniforms(sun->CalculateCombinedMatrix(), sun->GetPosition());
-	std::for_each(drawModels.begin(), drawModels.end(), [&](Model* drawModel) { drawModel->Draw(); });
-	playerCloud->Draw();
-	for (unsigned long long int i = 0; i < numCoins; i++)
+	pass->Depth(sceneDepth);
+	pass->scaled = true;
+
+	//shadow pass, the sun binds its own layered framebuffer per cascade
+	pass = renderGraph->AddPass("shadow", []()
+		{
+			glEnable(GL_MULTISAMPLE);
+			for (int cascade = 0; cascade < sun->GetNumCascades(); cascade++) //render each cascade into its layer
+			{
+				cullResults = cascadeVisibility[cascade].data();
+				lodView = LodView{ sun->GetPosition(), sun->GetTexelsPerUnit(cascade), 1.00f, true }; //from the cascade's texel size not the camera, so the cached static layer keeps matching
+				Shader* shader = shadowShader;
+				if (sun->StartStaticShadowPass(shader, cascade)) //only redraw the static casters when the cache is stale
+				{
+					renderQueue.Begin(sun->GetPosition());
+					std::for_each(staticCasters.begin(), staticCasters.end(), [&](Model* drawModel) { drawModel->Queue(renderQueue, shader); });
+					std::for_each(pistonLights.begin(), pistonLights.end(), [&](PistonLight* pistonLight) { pistonLight->QueueAll(renderQueue, shader); });
+					levelTestModel->Queue(renderQueue, shader);
+					renderQueue.Flush();
+				}
+				sun->StartShadowPass(shader, cascade);
+				renderQueue.Begin(sun->GetPosition());
+				std::for_each(dynamicCasters.begin(), dynamicCasters.end(), [&](Model* drawModel) { drawModel->Queue(renderQueue, shader); });
+				stamBar->Queue(renderQueue, shader);
+				for (unsigned long long int i = 0; i < numCoins; i++)
+				{
+					if (coins[i] != nullptr)
+						coins[i]->Queue(renderQueue, shader);
+				}
+				renderQueue.Flush();
+				shader = animatedShadowShader;
+				shader->Use();
+				shader->SetUniforms(sun->GetCascadeMatrix(cascade), sun->GetPosition());
+				DrawAnimated(shader);
+				shader = particleShadowShader;
+				shader->Use();
+				shader->SetUniforms(sun->GetCascadeMatrix(cascade), sun->GetPosition());
+				dustParticles->Draw(shader);
+			}
+			sun->EndShadowPass();
+		});
+	pass->Write(shadowMap);
+	pass->external = true;
+
+	if (deferredLighting)
 	{
-		if (coins[i] != nullptr)
-			coins[i]->Draw();
+		//lighting pass, the sun and ambient once per pixel from the G-buffer then a rect per point light added on top
+		pass = renderGraph->AddPass("lighting", []()
+			{
+				Shader* shader = deferredSunShader;
+				shader->Use();
+				sun->SetUniforms(shader);
+				SetRenderScaleUniforms(shader);
+				glm::mat4 inverseMatrix = glm::inverse(mainCamera->GetCombinedMatrix());
+				glUniformMatrix4fv(glGetUniformLocation(shader->GetProgram(), "inverseMatrix"), 1, false, glm::value_ptr(inverseMatrix));
+				DrawFullscreenTriangle();
+				shader = deferredPointLightShader;
+				shader->Use();
+				shader->SetUniforms();
+				SetRenderScaleUniforms(shader);
+				glUniformMatrix4fv(glGetUniformLocation(shader->GetProgram(), "inverseMatrix"), 1, false, glm::value_ptr(inverseMatrix));
+				DrawPointLights();
+			});
+		pass->Read(shadowMap, 2);
+		pass->Read(sceneDepth, 4);
+		pass->Read(albedo, 9);
+		pass->Read(worldNormal, 10);
+		pass->Write(sceneColor);
+		pass->depthTest = false;
+		pass->scaled = true;
+	}
+	else
+	{
+		//main pass, shades only the visible surface thanks to the outline buffer depth
+		//emissive objects share the queue so the stamina bar frame batches with the other diffuse draws
+		pass = renderGraph->AddPass("main", []()
+			{
+				cullResults = cameraVisibility.data();
+				lodView = LodView{ mainCamera->GetEyePosition(), mainCamera->GetPixelsPerUnit() * renderGraph->GetRenderScale(), 1.00f };
+				sun->SetUniforms(outlineShader);
+				sun->SetUniforms(emissiveOutlineShader);
+				renderQueue.Begin(mainCamera->GetEyePosition());
+				QueueLitModels(outlineShader);
+				stamBar->Queue(renderQueue, emissiveOutlineShader, outlineShader); //draw the staminaBar as emissive
+				std::for_each(pistonLights.begin(), pistonLights.end(), [&](PistonLight* pistonLight) { pistonLight->Queue(renderQueue, emissiveOutlineShader); });
+				renderQueue.Flush();
+				Shader* shader = animatedOutlineShader;
+				shader->Use();
+				sun->SetUniforms(shader);
+				DrawAnimated(shader);
+				shader = particleOutlineShader;
+				shader->Use();
+				sun->SetUniforms(shader);
+				dustParticles->Draw(shader);
+			});
+		pass->Read(shadowMap, 2);
+		pass->Write(sceneColor);
+		pass->Depth(sceneDepth, false, GL_LEQUAL);
+		pass->scaled = true;
 	}
-	levelTestModel->Draw();
-	shader = animatedOutlineShader;
-	shader->Use();
-	shader->SetUniforms(sun->CalculateCombinedMatrix(), sun->GetPosition());
-	player->Draw(shader);
-	std::for_each(pistons.begin(), pistons.end(), [&](Piston* pistons) { pistons->Draw(shader); });
 
-	//draw emissive objects
-	shader = emissiveOutlineShader;
-	shader->Use();
-	shader->SetUniforms(sun->CalculateCombinedMatrix(), sun->GetPosition());
-	stamBar->Draw(shader, outlineShader); //draw the staminaBar as emissive
-	std::for_each(pistonLights.begin(), pistonLights.end(), [&](PistonLight* pistonLight) { pistonLight->Draw(shader, outlineShader); });
+	//hi-z pass (shrink the depth to the max of each tile and queue a readback for next frame's occlusion culling)
+	pass = renderGraph->AddPass("hi-z", []()
+		{
+			hiZShader->Use();
+			SetRenderScaleUniforms(hiZShader);
+			DrawFullscreenTriangle();
+			occlusionCuller->Capture(mainCamera->GetCombinedMatrix());
+		});
+	pass->Read(sceneDepth, 4);
+	pass->Write(hiZ);
+	pass->depthTest = false;
+	pass->sideEffect = true; //only the CPU reads the result
 
-	//draw UI
-	toggleShader->Use();
-	toggle->Draw();
+	//composite pass (edge detect the outline buffer once per pixel and draw the lit scene with the outlines to the screen)
+	pass = renderGraph->AddPass("composite", []()
+		{
+			outlinePostShader->Use();
+			outlinePostShader->SetUniforms();
+			SetRenderScaleUniforms(outlinePostShader); //upscale the scene to the screen
+			DrawFullscreenTriangle();
+		});
+	pass->Read(outlineColor, 3);
+	pass->Read(sceneDepth, 4);
+	pass->Read(sceneColor, 7);
+	pass->Write(backbuffer);
+	pass->depthTest = false;
+
+	//draw UI, after the upscale so it stays at native resolution
+	pass = renderGraph->AddPass("ui", []()
+		{
+			cullResults = nullptr; //UI is drawn in screen space so can't be culled
+			lodView = LodView(); //or LODed
+			toggleShader->Use();
+			toggle->Draw();
+			if (showStats)
+				statsOverlay->Draw();
+		});
+	pass->Write(backbuffer);
+
+	renderGraph->Compile();
+}
+
+void Draw()
+{
+	//cull against each pass's view volume
+	UpdateDirtyBounds();
+	Frustum cameraFrustum = Frustum(mainCamera->GetCombinedMatrix());
+	worldBounds.Cull(cameraFrustum, cameraVisibility);
+	occlusionCuller->Update(); //pick up the newest depth the GPU has finished with
+	occlusionCuller->Cull(worldBounds, cameraVisibility); //then drop what was hidden behind it
+	sun->UpdateCascades(mainCamera); //fit the shadow cascades to this frame's view
+	for (int i = 0; i < sun->GetNumCascades(); i++) //each cascade gets its own draw list
+	{
+		Frustum cascadeFrustum = Frustum(sun->GetCascadeMatrix(i));
+		worldBounds.Cull(cascadeFrustum, cascadeVisibility[i]);
+	}
+	//sort the shadow casters, if the static set changed the cached shadows are stale
+	previousStaticCasters.swap(staticCasters);
+	staticCasters.clear();
+	dynamicCasters.clear();
+	std::for_each(drawModels.begin(), drawModels.end(), [&](Model* drawModel) { (drawModel->IsDynamic() ? dynamicCasters : staticCasters).push_back(drawModel); });
+	if (staticCasters != previousStaticCasters)
+		sun->InvalidateStaticShadows();
+	pointLights.clear();
+	glm::vec3 sceneAttenuation = SCENE_LIGHT_ATTENUATION;
+	pointLights.push_back(MakePointLight(SCENE_LIGHT_POSITION, SCENE_LIGHT_COLOR, sceneAttenuation.x, sceneAttenuation.y, sceneAttenuation.z)); //forward shading gets this as lights[0]
+	std::for_each(pistonLights.begin(), pistonLights.end(), [&](PistonLight* pistonLight) { pointLights.push_back(pistonLight->GetPointLight()); });
+
+	renderGraph->SetRenderScale(dynamicResolution->Update(renderGraph->GetGpuTime(true), renderGraph->GetGpuTime(false))); //resize the scene to fit the GPU budget
+	if (showStats)
+		UpdateStatsOverlay(); //from the last frame, this one hasn't been drawn yet
+	renderGraph->Execute();
+	frameStream->EndFrame();
 	
 	PrintGLErrors();
 
 	SDL_GL_SwapWindow(window);
-}
\ No newline at end of file
+}
+
+//read the benchmark options, anything unrecognised is ignored so the game still starts
+void ParseArguments(int argc, char** argv)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (argument == "--benchmark")
+			benchmark.enabled = true;
+		else if (argument == "--headless")
+		{
+			benchmark.enabled = true;
+			benchmark.headless = true;
+		}
+		else if (argument == "--software")
+			benchmark.software = true;
+		else if (argument == "--frames" && hasValue)
+			benchmark.frames = glm::max(atoi(argv[++i]), 1);
+		else if (argument == "--captures" && hasValue)
+			benchmark.captures = glm::max(atoi(argv[++i]), 0);
+		else if (argument == "--size" && hasValue)
+		{
+			int width = 0;
+			int height = 0;
+			if (sscanf(argv[++i], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+			{
+				benchmark.width = width;
+				benchmark.height = height;
+			}
+			else
+				std::cout << "Warning: --size wants WIDTHxHEIGHT, got " << argv[i] << "\n";
+		}
+		else if (argument == "--dump" && hasValue)
+		{
+			benchmark.enabled = true;
+			benchmark.dumpPath = argv[++i];
+		}
+		else if (argument == "--golden" && hasValue)
+		{
+			benchmark.enabled = true;
+			benchmark.goldenPath = argv[++i];
+		}
+		else if (argument == "--report" && hasValue)
+		{
+			benchmark.enabled = true;
+			benchmark.reportPath = argv[++i];
+		}
+		else
+			std::cout << "Warning: Unknown argument " << argument << "\n";
+	}
+	benchmark.warmup = glm::min(benchmark.warmup, benchmark.frames - 1);
+}
+
+//the route the benchmark flies, from the spawn past the crates, the pistons and the barrels then up to an overview
+CameraPath MakeLevel01Path()
+{
+	CameraPath path;
+	path.AddKey(0.00f, glm::vec3(-9.00f, 1.00f, -4.00f), glm::radians(90.00f), glm::radians(45.00f), 3.00f);
+	path.AddKey(3.00f, glm::vec3(-5.00f, 1.00f, 2.00f), glm::radians(150.00f), glm::radians(35.00f), 5.00f);
+	path.AddKey(6.00f, glm::vec3(0.50f, 1.00f, 1.00f), glm::radians(220.00f), glm::radians(30.00f), 7.00f);
+	path.AddKey(9.00f, glm::vec3(5.00f, 1.00f, 9.00f), glm::radians(300.00f), glm::radians(40.00f), 5.00f);
+	path.AddKey(12.00f, glm::vec3(0.00f, 0.00f, 2.00f), glm::radians(420.00f), glm::radians(60.00f), 14.00f);
+	return path;
+}
+
+//renders level 01 along MakeLevel01Path with nothing simulated so every run draws the same frames
+//prints the per pass timings, dumps and/or compares the captures, returns non zero if a capture didn't match
+int RunBenchmark()
+{
+	UnloadMainMenu();
+	LoadLevel01();
+	dynamicResolution->SetScaleRange(1.00f, 1.00f); //a fixed resolution, the captures have to line up with the references
+	occlusionCuller->SetWaitForNewest(true); //a fixed one frame lag, otherwise what gets culled depends on GPU speed
+	CameraPath path = MakeLevel01Path();
+	std::vector<RenderPass*>& passes = renderGraph->GetPasses();
+	std::vector<double> gpuTotal = std::vector<double>(passes.size(), 0.00);
+	std::vector<double> gpuMax = std::vector<double>(passes.size(), 0.00);
+	std::vector<double> cpuTotal = std::vector<double>(passes.size(), 0.00);
+	std::vector<RenderStats> statsTotal = std::vector<RenderStats>(passes.size());
+	RenderStats frameStatsTotal;
+	double occlusionTestedTotal = 0.00;
+	double occludedTotal = 0.00;
+	double particlesTotal = 0.00;
+	double frameTotal = 0.00;
+	int timedFrames = 0;
+	int failures = 0;
+	int nextCapture = 0;
+	if (!benchmark.dumpPath.empty())
+	{
+		std::error_code error;
+		std::filesystem::create_directories(benchmark.dumpPath, error);
+	}
+
+	unsigned long long frameStart = SDL_GetPerformanceCounter();
+	for (int frame = 0; frame < benchmark.frames; frame++)
+	{
+		HandleEvents(); //still lets a windowed run be closed
+		float time = benchmark.frames > 1 ? path.GetDuration() * (float)frame / (float)(benchmark.frames - 1) : 0.00f;
+		frameStream->BeginFrame();
+		path.Apply(mainCamera, time);
+		Draw();
+
+		unsigned long long frameEnd = SDL_GetPerformanceCounter();
+		if (frame >= benchmark.warmup) //timer queries lag two frames so these are from a couple of frames back
+		{
+			for (unsigned int p = 0; p < passes.size(); p++)
+			{
+				if (passes[p]->culled)
+					continue;
+				gpuTotal[p] += passes[p]->gpuTime;
+				gpuMax[p] = glm::max(gpuMax[p], passes[p]->gpuTime);
+				cpuTotal[p] += passes[p]->cpuTime;
+				statsTotal[p].Add(passes[p]->stats);
+			}
+			frameStatsTotal.Add(renderGraph->GetFrameStats());
+			occlusionTestedTotal += occlusionCuller->GetTestedCount();
+			occludedTotal += occlusionCuller->GetOccludedCount();
+			particlesTotal += dustParticles->GetLiveCount();
+			frameTotal += (double)(frameEnd - frameStart) * 1000.00 / (double)SDL_GetPerformanceFrequency();
+			timedFrames++;
+		}
+
+		//captures are spread from the first frame to the last
+		int captureFrame = benchmark.captures > 1 ? (nextCapture * (benchmark.frames - 1)) / (benchmark.captures - 1) : 0;
+		if (nextCapture < benchmark.captures && frame == captureFrame && (!benchmark.dumpPath.empty() || !benchmark.goldenPath.empty()))
+		{
+			FrameImage image = FrameImage(offscreenTarget->GetColor()); //stalls, so the frames after a capture read slow
+			char name[32];
+			snprintf(name, sizeof(name), "frame_%03d.ppm", nextCapture);
+			if (!benchmark.dumpPath.empty())
+				image.Save((std::filesystem::path(benchmark.dumpPath) / name).string().c_str());
+			if (!benchmark.goldenPath.empty())
+			{
+				FrameImage reference;
+				std::string referencePath = (std::filesystem::path(benchmark.goldenPath) / name).string();
+				float rmse = 0.00f;
+				if (!reference.Load(referencePath.c_str()))
+				{
+					std::cout << "Error: Couldn't read reference image " << referencePath << "!\n";
+					failures++;
+				}
+				else
+				{
+					float mismatch = image.Compare(reference, benchmark.tolerance, &rmse);
+					bool passed = mismatch <= benchmark.maxMismatch;
+					std::cout << (passed ? "Pass " : "FAIL ") << name << ": " << mismatch * 100.00f << "% of pixels differ, rmse " << rmse << "\n";
+					if (!passed)
+						failures++;
+				}
+			}
+			nextCapture++;
+		}
+		frameStart = SDL_GetPerformanceCounter(); //leave the capture stall out of the frame times
+	}
+
+	//the report, averages are over the frames after the warm up
+	double frames = (double)glm::max(timedFrames, 1);
+	std::cout << "Benchmark: " << timedFrames << " frames at " << benchmark.width << "x" << benchmark.height << ", " << frameTotal / frames << "ms per frame\n";
+	std::cout << "pass                  gpu avg    gpu max    cpu avg   draws  triangles\n";
+	std::ofstream report;
+	if (!benchmark.reportPath.empty()) //the stats columns are averages per frame too
+	{
+		report.open(benchmark.reportPath, std::ios::out | std::ios::trunc);
+		report << "pass,gpu avg ms,gpu max ms,cpu avg ms,draws,instances,triangles,program switches,vao switches,framebuffer binds,texture binds,uniform bytes,buffer bytes,occlusion tested,occluded,live particles\n"; //the last three are only per frame
+	}
+	auto writeStats = [&](RenderStats& total)
+		{
+			report << "," << total.draws / frames << "," << total.instances / frames << "," << total.triangles / frames << "," << total.programSwitches / frames << "," << total.vertexArraySwitches / frames
+				<< "," << total.framebufferBinds / frames << "," << total.textureBinds / frames << "," << total.uniformBytes / frames << "," << total.bufferBytes / frames;
+		};
+	double gpuSum = 0.00;
+	for (unsigned int p = 0; p < passes.size(); p++)
+	{
+		if (passes[p]->culled)
+			continue;
+		char line[128];
+		snprintf(line, sizeof(line), "%-20s %8.3fms %8.3fms %8.3fms %7.0f %10.0f", passes[p]->name, gpuTotal[p] / frames, gpuMax[p], cpuTotal[p] / frames, statsTotal[p].draws / frames, statsTotal[p].triangles / frames);
+		std::cout << line << "\n";
+		if (report.is_open())
+		{
+			report << passes[p]->name << "," << gpuTotal[p] / frames << "," << gpuMax[p] << "," << cpuTotal[p] / frames;
+			writeStats(statsTotal[p]);
+			report << ",,,\n";
+		}
+		gpuSum += gpuTotal[p] / frames;
+	}
+	std::cout << "total gpu             " << gpuSum << "ms\n";
+	std::cout << "per frame: " << frameStatsTotal.draws / frames << " draws, " << frameStatsTotal.triangles / frames << " triangles, " << frameStatsTotal.programSwitches / frames << " program switches, "
+		<< frameStatsTotal.vertexArraySwitches / frames << " vao switches, " << frameStatsTotal.uniformBytes / frames << " uniform bytes, " << frameStatsTotal.bufferBytes / frames << " buffer bytes\n";
+	std::cout << "per frame: " << occludedTotal / frames << " of " << occlusionTestedTotal / frames << " bounds occluded, " << particlesTotal / frames << " live particles\n";
+	if (report.is_open())
+	{
+		report << "frame," << gpuSum << ",," << frameTotal / frames;
+		writeStats(frameStatsTotal);
+		report << "," << occlusionTestedTotal / frames << "," << occludedTotal / frames << "," << particlesTotal / frames << "\n";
+	}
+	if (!benchmark.goldenPath.empty())
+		std::cout << (failures == 0 ? "All captures match\n" : "Some captures don't match\n");
+	return failures == 0 ? 0 : 1;
+}
+
+//1234, 12.3K, 1.23M, keeps the overlay columns narrow
+std::string FormatCount(double count)
+{
+	char text[16];
+	if (count >= 1000000.00)
+		snprintf(text, sizeof(text), "%.2fM", count / 1000000.00);
+	else if (count >= 10000.00)
+		snprintf(text, sizeof(text), "%.1fK", count / 1000.00);
+	else
+		snprintf(text, sizeof(text), "%.0f", count);
+	return text;
+}
+
+//one overlay row, the stats are what the pass (or frame) submitted, uniforms and buffers are in bytes
+std::string FormatStatsRow(const char* name, RenderStats& stats, double gpuTime)
+{
+	char line[128];
+	snprintf(line, sizeof(line), "%-18.18s%6s%6s%8s%6s%6s%6s%6s%8s%8s%7.2f", name, FormatCount((double)stats.draws).c_str(), FormatCount((double)stats.instances).c_str(), FormatCount((double)stats.triangles).c_str(),
+		FormatCount((double)stats.programSwitches).c_str(), FormatCount((double)stats.vertexArraySwitches).c_str(), FormatCount((double)stats.framebufferBinds).c_str(), FormatCount((double)stats.textureBinds).c_str(),
+		FormatCount((double)stats.uniformBytes).c_str(), FormatCount((double)stats.bufferBytes).c_str(), gpuTime);
+	return line;
+}
+
+//refill the overlay with the last frame's totals then one row per live pass
+void UpdateStatsOverlay()
+{
+	std::vector<RenderPass*>& passes = renderGraph->GetPasses();
+	char line[128];
+	snprintf(line, sizeof(line), "frame %llums  scale %.2f  stream %uK", dTime, renderGraph->GetRenderScale(), frameStream->GetUsed() / 1024);
+	statsOverlay->Clear();
+	statsOverlay->AddLine(line);
+	snprintf(line, sizeof(line), "occluded %u of %u  particles %u", occlusionCuller->GetOccludedCount(), occlusionCuller->GetTestedCount(), dustParticles != nullptr ? dustParticles->GetLiveCount() : 0);
+	statsOverlay->AddLine(line);
+	snprintf(line, sizeof(line), "%-18s%6s%6s%8s%6s%6s%6s%6s%8s%8s%7s", "", "draws", "inst", "tris", "prog", "vao", "fbo", "tex", "unif", "buff", "gpums");
+	statsOverlay->AddLine(line);
+	statsOverlay->AddLine(FormatStatsRow("frame", renderGraph->GetFrameStats(), renderGraph->GetGpuTime(true) + renderGraph->GetGpuTime(false)));
+	for (unsigned int p = 0; p < passes.size(); p++)
+	{
+		if (!passes[p]->culled)
+			statsOverlay->AddLine(FormatStatsRow(passes[p]->name, passes[p]->stats, passes[p]->gpuTime));
+	}
+}